@@ -0,0 +1,485 @@
+// Migration cost model: fit from recorded migrations, predict planned ones.
+//
+// The fit is least squares on the relative error, so a 10 us call and a
+// 100 ms call weigh the same, with non-negativity enforced by dropping a
+// term whose coefficient comes out negative and refitting without it.
+// Terms the data cannot separate (no THPs, no concurrency) are dropped the
+// same way and predict nothing.
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "cost_model.h"
+
+#define MC_CALLS        4096    /* calls simulated one by one per trial */
+#define RIDGE           1e-9    /* relative to the diagonal, keeps near-collinear terms solvable */
+
+/* ------------- Samples ------------- */
+int cost_samples_add(struct cost_samples *s, const struct cost_sample *x)
+{
+        if (s->nr == s->cap) {
+                unsigned long cap = s->cap ? 2 * s->cap : 1024;
+                struct cost_sample *v = realloc(s->v, cap * sizeof(*v));
+                if (!v)
+                        return -ENOMEM;
+                s->v = v;
+                s->cap = cap;
+        }
+        s->v[s->nr++] = *x;
+        return 0;
+}
+
+void cost_samples_free(struct cost_samples *s)
+{
+        free(s->v);
+        *s = (struct cost_samples){ 0 };
+}
+
+/* Split @line in place on commas, NULL past the last; returns the number of fields */
+static int split_csv(char *line, char **fields, int max)
+{
+        int n = 0;
+
+        for (int i = 0; i < max; i++)
+                fields[i] = NULL;
+        line[strcspn(line, "\r\n")] = 0;
+        while (n < max) {
+                fields[n++] = line;
+                line = strchr(line, ',');
+                if (!line)
+                        break;
+                *line++ = 0;
+        }
+        return n;
+}
+
+/*
+ * Read the CSV at @path, skipping comments and the header (the line that
+ * starts with @header), and hand each row of at least @min fields to @row.
+ * Returns the number of samples added or -errno.
+ */
+static int load_csv(struct cost_samples *s, const char *path, const char *header, int min,
+                    int (*row)(char **f, struct cost_sample *x, void *arg), void *arg)
+{
+        FILE *f = fopen(path, "r");
+        char line[512], *fields[16];
+        int added = 0, err = 0;
+
+        if (!f)
+                return -errno;
+        while (!err && fgets(line, sizeof(line), f)) {
+                struct cost_sample x;
+                if (line[0] == '#' || !strncmp(line, header, strlen(header)))
+                        continue;
+                if (split_csv(line, fields, 16) < min || !row(fields, &x, arg))
+                        continue;
+                if (x.ns <= 0 || x.calls <= 0 || x.base + x.huge <= 0)
+                        continue;
+                err = cost_samples_add(s, &x);
+                added++;
+        }
+        fclose(f);
+        return err ? err : added;
+}
+
+/* ts_ns,pid,comm,reason,mode,pages_ok,pages_failed,thp_ok,thp_failed,inflight,lat_ns */
+static int migrate_lat_row(char **f, struct cost_sample *x, void *arg)
+{
+        int reason = *(int *)arg;
+        double ok = strtod(f[5], NULL), failed = strtod(f[6], NULL);
+        double thps = strtod(f[7], NULL) + strtod(f[8], NULL);
+
+        if (reason >= 0 && atoi(f[3]) != reason)
+                return 0;
+        /* pages_ok/failed count the subpages of a THP too */
+        *x = (struct cost_sample){
+                .calls    = 1,
+                .huge     = thps,
+                .base     = fmax(ok + failed - COST_HUGE_PAGES * thps, 0),
+                .inflight = fmax(strtod(f[9], NULL), 1),
+                .failed   = failed,
+                .ns       = strtod(f[10], NULL),
+                .per_call = 1,
+        };
+        return 1;
+}
+
+/**
+ * cost_load_migrate_lat - Add the calls of a migrate_lat -o recording,
+ * only those for migrate_reason @reason unless it is negative.
+ */
+int cost_load_migrate_lat(struct cost_samples *s, const char *path, int reason)
+{
+        return load_csv(s, path, "ts_ns,", 11, migrate_lat_row, &reason);
+}
+
+/*
+ * pages,page_size,batch,calls,moved,failed,move_ns,total_ns[,engine,threads]
+ * Rows without an engine are move_pages runs; only those of engine @arg
+ * are taken.
+ */
+static int sweep_row(char **f, struct cost_sample *x, void *arg)
+{
+        double pages = strtod(f[0], NULL);
+        unsigned long page_size = strtoul(f[1], NULL, 0);
+        int huge = page_size >= COST_HUGE_PAGES * COST_BASE_PAGE;
+
+        if (strcmp(f[8] ? f[8] : "move_pages", arg))
+                return 0;
+
+        *x = (struct cost_sample){
+                .calls    = strtod(f[3], NULL),
+                .huge     = huge ? pages : 0,
+                .base     = huge ? 0 : pages * page_size / COST_BASE_PAGE,
+                .inflight = f[9] ? fmax(strtod(f[9], NULL), 1) : 1,
+                .failed   = strtod(f[5], NULL) * (huge ? COST_HUGE_PAGES : 1),
+                .ns       = strtod(f[6], NULL),
+        };
+        return 1;
+}
+
+/**
+ * cost_load_sweep - Add the move_pages runs of a page_migrations -o sweep;
+ * each run is one sample of all its calls, its threads being the migrations
+ * in flight.  mbind and migrate_pages runs are left out: the model is one
+ * of move_pages calls, and migrate_pages moves the whole process, not just
+ * the pages its row counts.
+ */
+int cost_load_sweep(struct cost_samples *s, const char *path)
+{
+        return load_csv(s, path, "pages,", 8, sweep_row, "move_pages");
+}
+
+/* ------------- Fit ------------- */
+static void features(const struct cost_sample *x, double *v)
+{
+        v[COST_FIXED]      = x->calls;
+        v[COST_PAGE]       = x->base;
+        v[COST_HUGE]       = x->huge;
+        v[COST_CONTENTION] = (x->inflight - 1) * (x->base + COST_HUGE_PAGES * x->huge);
+}
+
+double cost_model_mean(const struct cost_model *m, const struct cost_sample *x)
+{
+        double v[COST_NR_TERMS], ns = 0;
+
+        features(x, v);
+        for (int j = 0; j < COST_NR_TERMS; j++)
+                ns += m->coef[j] * v[j];
+        return ns;
+}
+
+/* Solve the @n x @n system @a x = @b in place by Gaussian elimination */
+static int solve(int n, double a[][COST_NR_TERMS], double *b, double *x)
+{
+        for (int c = 0; c < n; c++) {
+                int p = c;
+                for (int r = c + 1; r < n; r++) {
+                        if (fabs(a[r][c]) > fabs(a[p][c]))
+                                p = r;
+                }
+                if (a[p][c] == 0)
+                        return -EDOM;
+                for (int k = 0; k < n; k++) {
+                        double t = a[c][k]; a[c][k] = a[p][k]; a[p][k] = t;
+                }
+                double t = b[c]; b[c] = b[p]; b[p] = t;
+                for (int r = c + 1; r < n; r++) {
+                        double f = a[r][c] / a[c][c];
+                        for (int k = c; k < n; k++)
+                                a[r][k] -= f * a[c][k];
+                        b[r] -= f * b[c];
+                }
+        }
+        for (int r = n - 1; r >= 0; r--) {
+                x[r] = b[r];
+                for (int k = r + 1; k < n; k++)
+                        x[r] -= a[r][k] * x[k];
+                x[r] /= a[r][r];
+        }
+        return 0;
+}
+
+/* Relative least squares over the terms in @active; 0 when all come out >= 0 */
+static int fit_active(const struct cost_samples *s, const int *active, int n, double *coef)
+{
+        double a[COST_NR_TERMS][COST_NR_TERMS] = { 0 }, b[COST_NR_TERMS] = { 0 }, x[COST_NR_TERMS];
+        int worst = -1, err;
+
+        for (unsigned long i = 0; i < s->nr; i++) {
+                double v[COST_NR_TERMS];
+                features(&s->v[i], v);
+                for (int r = 0; r < n; r++) {
+                        double vr = v[active[r]] / s->v[i].ns;
+                        for (int c = 0; c < n; c++)
+                                a[r][c] += vr * v[active[c]] / s->v[i].ns;
+                        b[r] += vr;
+                }
+        }
+        for (int r = 0; r < n; r++)
+                a[r][r] *= 1 + RIDGE;
+        if ((err = solve(n, a, b, x)))
+                return err;
+        for (int r = 0; r < n; r++) {
+                coef[active[r]] = x[r];
+                if (x[r] < 0 && (worst < 0 || x[r] < x[worst]))
+                        worst = r;
+        }
+        return worst < 0 ? 0 : worst + 1;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+        double x = *(const double *)a, y = *(const double *)b;
+        return x < y ? -1 : x > y;
+}
+
+/* Percentiles 0..100 of the @n values of @v, which get sorted */
+static void quantiles(double *v, unsigned long n, double *q)
+{
+        qsort(v, n, sizeof(*v), cmp_double);
+        for (int i = 0; i < COST_NR_QUANTILES; i++)
+                q[i] = v[(unsigned long)((n - 1) * i / 100.0 + 0.5)];
+}
+
+/**
+ * cost_model_fit - Fit @m to the samples of @s.
+ *
+ * Returns -EINVAL when there are fewer samples than terms or no term can be
+ * fitted with a non-negative cost.
+ */
+int cost_model_fit(struct cost_model *m, const struct cost_samples *s)
+{
+        int active[COST_NR_TERMS], n = 0, ret;
+        double pages = 0, failed = 0, *ratio, *call;
+        unsigned long nr_call = 0;
+
+        *m = (struct cost_model){ .samples = s->nr };
+        /* a term no sample exercises has nothing to fit */
+        for (int j = 0; j < COST_NR_TERMS; j++) {
+                for (unsigned long i = 0; i < s->nr; i++) {
+                        double v[COST_NR_TERMS];
+                        features(&s->v[i], v);
+                        if (v[j] > 0) {
+                                active[n++] = j;
+                                break;
+                        }
+                }
+        }
+        if (s->nr < (unsigned long)n)
+                return -EINVAL;
+        while (n > 0 && (ret = fit_active(s, active, n, m->coef)) != 0) {
+                /* singular: the last term is a combination of the others */
+                int drop = ret < 0 ? n - 1 : ret - 1;
+                m->coef[active[drop]] = 0;
+                memmove(&active[drop], &active[drop + 1], (n - drop - 1) * sizeof(*active));
+                n--;
+        }
+        if (!n)
+                return -EINVAL;
+
+        ratio = malloc(2 * s->nr * sizeof(*ratio));
+        if (!ratio)
+                return -ENOMEM;
+        call = ratio + s->nr;
+        for (unsigned long i = 0; i < s->nr; i++) {
+                double mean = cost_model_mean(m, &s->v[i]);
+                ratio[i] = mean > 0 ? s->v[i].ns / mean : 1;
+                if (s->v[i].per_call)
+                        call[nr_call++] = ratio[i];
+                pages  += s->v[i].base + COST_HUGE_PAGES * s->v[i].huge;
+                failed += s->v[i].failed;
+        }
+        quantiles(ratio, s->nr, m->ratio);
+        /* no single calls recorded: runs are all there is to go by */
+        if (nr_call)
+                quantiles(call, nr_call, m->call_ratio);
+        else
+                memcpy(m->call_ratio, m->ratio, sizeof(m->ratio));
+        free(ratio);
+        m->fail_prob = pages > 0 ? failed / pages : 0;
+        return 0;
+}
+
+/* ------------- Persistence ------------- */
+static const char *const term_names[COST_NR_TERMS] = {
+        [COST_FIXED]      = "fixed_ns",
+        [COST_PAGE]       = "page_ns",
+        [COST_HUGE]       = "huge_ns",
+        [COST_CONTENTION] = "contention_ns",
+};
+
+void cost_model_print(FILE *out, const struct cost_model *m)
+{
+        fprintf(out, "samples: %lu\n", m->samples);
+        fprintf(out, "per call: %.1f us, per page: %.3f us, per THP: %.1f us, "
+                "per page and concurrent migration: %.3f us\n",
+                m->coef[COST_FIXED] / 1e3, m->coef[COST_PAGE] / 1e3,
+                m->coef[COST_HUGE] / 1e3, m->coef[COST_CONTENTION] / 1e3);
+        fprintf(out, "pages failing: %.3f%%\n", 100 * m->fail_prob);
+        fprintf(out, "observed / predicted: p10 %.2f, p50 %.2f, p90 %.2f, p99 %.2f\n",
+                m->ratio[10], m->ratio[50], m->ratio[90], m->ratio[99]);
+        fprintf(out, "... of single calls: p50 %.2f, p99 %.2f\n", m->call_ratio[50], m->call_ratio[99]);
+}
+
+int cost_model_save(const struct cost_model *m, FILE *f)
+{
+        fprintf(f, "# cost_model v1\n");
+        fprintf(f, "samples %lu\n", m->samples);
+        for (int j = 0; j < COST_NR_TERMS; j++)
+                fprintf(f, "%s %.6g\n", term_names[j], m->coef[j]);
+        fprintf(f, "fail_prob %.6g\n", m->fail_prob);
+        fprintf(f, "ratio");
+        for (int q = 0; q < COST_NR_QUANTILES; q++)
+                fprintf(f, " %.4g", m->ratio[q]);
+        fprintf(f, "\ncall_ratio");
+        for (int q = 0; q < COST_NR_QUANTILES; q++)
+                fprintf(f, " %.4g", m->call_ratio[q]);
+        fprintf(f, "\n");
+        return ferror(f) ? -EIO : 0;
+}
+
+static int parse_quantiles(const char *p, double *q)
+{
+        char *end;
+
+        for (int i = 0; i < COST_NR_QUANTILES; i++, p = end) {
+                q[i] = strtod(p, &end);
+                if (end == p)
+                        return -EINVAL;
+        }
+        return 0;
+}
+
+/**
+ * cost_model_load - Read a model written by cost_model_save(); unknown keys
+ * are ignored so that newer terms do not break older readers.  A model
+ * saved without call_ratio uses its ratio for single calls.
+ */
+int cost_model_load(struct cost_model *m, FILE *f)
+{
+        char line[2048], key[32];
+        int have = 0, off;
+
+        *m = (struct cost_model){ 0 };
+        while (fgets(line, sizeof(line), f)) {
+                if (line[0] == '#' || sscanf(line, "%31s%n", key, &off) != 1)
+                        continue;
+                if (!strcmp(key, "ratio")) {
+                        if (parse_quantiles(line + off, m->ratio))
+                                return -EINVAL;
+                        have |= 1;
+                        continue;
+                }
+                if (!strcmp(key, "call_ratio")) {
+                        if (parse_quantiles(line + off, m->call_ratio))
+                                return -EINVAL;
+                        have |= 4;
+                        continue;
+                }
+                if (!strcmp(key, "samples"))
+                        m->samples = strtoul(line + off, NULL, 0);
+                else if (!strcmp(key, "fail_prob"))
+                        m->fail_prob = strtod(line + off, NULL);
+                for (int j = 0; j < COST_NR_TERMS; j++) {
+                        if (!strcmp(key, term_names[j])) {
+                                m->coef[j] = strtod(line + off, NULL);
+                                have |= 2;
+                        }
+                }
+        }
+        if ((have & 3) != 3)
+                return -EINVAL;
+        if (!(have & 4))
+                memcpy(m->call_ratio, m->ratio, sizeof(m->ratio));
+        return 0;
+}
+
+/* ------------- Prediction ------------- */
+static double next_random(unsigned long long *rng)
+{
+        *rng ^= *rng << 13;
+        *rng ^= *rng >> 7;
+        *rng ^= *rng << 17;
+        return (*rng >> 11) * (1.0 / (1ULL << 53));
+}
+
+/*
+ * A draw from the observed / predicted distribution of one call.  Run
+ * residuals are already averages over many calls: drawing from them would
+ * shrink the spread twice.
+ */
+static double draw_ratio(const struct cost_model *m, unsigned long long *rng)
+{
+        double u = next_random(rng) * (COST_NR_QUANTILES - 1);
+        int q = (int)u;
+
+        if (q >= COST_NR_QUANTILES - 1)
+                return m->call_ratio[COST_NR_QUANTILES - 1];
+        return m->call_ratio[q] + (u - q) * (m->call_ratio[q + 1] - m->call_ratio[q]);
+}
+
+static double ratio_mean(const struct cost_model *m)
+{
+        double sum = 0;
+
+        /* trapezoids between the percentiles */
+        for (int q = 0; q < COST_NR_QUANTILES - 1; q++)
+                sum += (m->call_ratio[q] + m->call_ratio[q + 1]) / 2;
+        return sum / (COST_NR_QUANTILES - 1);
+}
+
+/**
+ * cost_model_predict - Latency distribution of migrating @p->bytes in calls
+ * of @p->batch pages, from @trials Monte Carlo runs seeded with @seed.
+ *
+ * Each call costs its share of the model's mean times a ratio drawn from
+ * the per-call residuals (the run residuals when there are none).  Past MC_CALLS calls a trial draws MC_CALLS ratios
+ * and shrinks their deviation from the mean by sqrt(MC_CALLS / calls), as
+ * the average of that many independent calls would.
+ */
+int cost_model_predict(const struct cost_model *m, const struct cost_plan *p, unsigned int trials,
+                       unsigned long long seed, struct cost_prediction *out)
+{
+        double huge_bytes = p->bytes * p->huge_frac;
+        struct cost_sample x = {
+                .huge     = floor(huge_bytes / (COST_HUGE_PAGES * COST_BASE_PAGE)),
+                .base     = ceil((p->bytes - huge_bytes) / COST_BASE_PAGE),
+                .inflight = p->concurrency ? p->concurrency : 1,
+        };
+        unsigned long long rng = 88172645463325252ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+        double entries = x.base + x.huge, call_ns, rmean = ratio_mean(m), *total;
+        unsigned long draws;
+
+        if (!trials || p->huge_frac < 0 || p->huge_frac > 1)
+                return -EINVAL;
+        x.calls = entries <= 0 ? 0 : p->batch ? ceil(entries / p->batch) : 1;
+        *out = (struct cost_prediction){ .calls = x.calls };
+        if (!x.calls)
+                return 0;
+        total = malloc(trials * sizeof(*total));
+        if (!total)
+                return -ENOMEM;
+
+        call_ns = cost_model_mean(m, &x) / x.calls;
+        draws = x.calls < MC_CALLS ? x.calls : MC_CALLS;
+        for (unsigned int t = 0; t < trials; t++) {
+                double sum = 0;
+                for (unsigned long c = 0; c < draws; c++)
+                        sum += draw_ratio(m, &rng);
+                if (draws < x.calls)
+                        sum = x.calls * (rmean + (sum / draws - rmean) * sqrt((double)draws / x.calls));
+                total[t] = call_ns * sum;
+                out->mean_ns += total[t] / trials;
+        }
+        qsort(total, trials, sizeof(*total), cmp_double);
+        out->p50_ns = total[(trials - 1) / 2];
+        out->p90_ns = total[(unsigned long)((trials - 1) * 0.90 + 0.5)];
+        out->p99_ns = total[(unsigned long)((trials - 1) * 0.99 + 0.5)];
+        out->max_ns = total[trials - 1];
+        out->call_p50_ns = call_ns * m->call_ratio[50];
+        out->call_p99_ns = call_ns * m->call_ratio[99];
+        out->failed_pages = m->fail_prob * (x.base + COST_HUGE_PAGES * x.huge);
+        free(total);
+        return 0;
+}
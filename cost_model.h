@@ -0,0 +1,85 @@
+#ifndef __COST_MODEL_H
+#define __COST_MODEL_H
+
+#include <stdio.h>
+
+/*
+ * Per-host migration cost model, fitted offline from migrate_lat -o
+ * recordings and page_migrations -o sweeps:
+ *
+ *   ns = fixed * calls + page * base + huge * thps
+ *        + contention * (inflight - 1) * (base + COST_HUGE_PAGES * thps)
+ *
+ * The spread around that mean is kept as quantiles of observed / predicted,
+ * which is what turns a planned migration into a latency distribution.
+ * Those of single calls are kept apart too: a sweep run averages many calls
+ * and hides how long one of them can stall.
+ */
+
+#define COST_HUGE_PAGES         512     /* base pages in a PMD-sized THP */
+#define COST_BASE_PAGE          4096UL
+#define COST_NR_QUANTILES       101     /* percentiles 0..100 */
+
+/* One migrate_pages() call, or one page_migrations run of several calls */
+struct cost_sample {
+        double calls;
+        double base;            /* base pages attempted outside THPs */
+        double huge;            /* THPs attempted */
+        double inflight;        /* concurrent migrations, this one included */
+        double failed;          /* base pages that did not move */
+        double ns;
+        int per_call;           /* a single call, not a run of them */
+};
+
+struct cost_samples {
+        struct cost_sample *v;
+        unsigned long nr, cap;
+};
+
+int cost_samples_add(struct cost_samples *s, const struct cost_sample *x);
+void cost_samples_free(struct cost_samples *s);
+int cost_load_migrate_lat(struct cost_samples *s, const char *path, int reason);
+int cost_load_sweep(struct cost_samples *s, const char *path);
+
+/* ------------- Model ------------- */
+enum cost_term {
+        COST_FIXED,             /* ns per call */
+        COST_PAGE,              /* ns per base page */
+        COST_HUGE,              /* ns per THP */
+        COST_CONTENTION,        /* ns per page and other migration in flight */
+        COST_NR_TERMS,
+};
+
+struct cost_model {
+        double coef[COST_NR_TERMS];
+        double fail_prob;       /* share of pages that fail to move */
+        unsigned long samples;
+        double ratio[COST_NR_QUANTILES];        /* observed / predicted */
+        double call_ratio[COST_NR_QUANTILES];   /* ... of per-call samples only */
+};
+
+int cost_model_fit(struct cost_model *m, const struct cost_samples *s);
+double cost_model_mean(const struct cost_model *m, const struct cost_sample *x);
+void cost_model_print(FILE *out, const struct cost_model *m);
+int cost_model_save(const struct cost_model *m, FILE *f);
+int cost_model_load(struct cost_model *m, FILE *f);
+
+/* ------------- Prediction ------------- */
+struct cost_plan {
+        unsigned long long bytes;
+        double huge_frac;               /* share of @bytes backed by THPs */
+        unsigned long batch;            /* pages per call, 0 = one call */
+        unsigned int concurrency;       /* migrations running at the same time */
+};
+
+struct cost_prediction {
+        unsigned long calls;
+        double mean_ns, p50_ns, p90_ns, p99_ns, max_ns;         /* whole migration */
+        double call_p50_ns, call_p99_ns;        /* one call: how long pages stay locked */
+        double failed_pages;
+};
+
+int cost_model_predict(const struct cost_model *m, const struct cost_plan *p, unsigned int trials,
+                       unsigned long long seed, struct cost_prediction *out);
+
+#endif /* __COST_MODEL_H */
@@ -0,0 +1,198 @@
+// Fit the migration cost model of this host and ask it about planned
+// migrations:
+//
+//   cost_model fit -i lat.csv [-s sweep.csv] [-r reason] [-o model]
+//   cost_model predict -m model [-H huge%] [-b batch] [-c concurrency] 4G
+//
+// predict exits 2 when a -g or -G gate is exceeded, so a rebalancing
+// script can run it first and skip or split the migration.
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <string.h>
+#include "cost_model.h"
+
+static const char *prog;
+
+static void usage(void)
+{
+        fprintf(stderr,
+                "Usage: %s fit [-i migrate_lat.csv]... [-s sweep.csv]... [-r reason] [-o model]\n"
+                "       %s predict -m model [-H huge%%] [-b batch] [-c concurrency]\n"
+                "          [-t trials] [-g max-ms] [-G call-max-ms] <size>[K|M|G|T]\n"
+                "  -i  recording of migrate_lat -o\n"
+                "  -s  sweep of page_migrations -o\n"
+                "  -r  only calls with this migrate_reason, e.g. 3 for move_pages and\n"
+                "      migratepages, 5 for NUMA balancing (default: all)\n"
+                "  -o  where to write the model (default: stdout)\n"
+                "  -H  share of the memory backed by THPs, in %% (default 0)\n"
+                "  -b  pages per move_pages call (default: all in one call)\n"
+                "  -c  migrations running at the same time (default 1)\n"
+                "  -t  Monte Carlo trials (default 10000)\n"
+                "  -g  fail if the p99 of the whole migration exceeds this\n"
+                "  -G  fail if the p99 of one call, the longest stall, exceeds this\n",
+                prog, prog);
+}
+
+static int parse_size(const char *s, unsigned long long *bytes)
+{
+        char *end;
+        double v = strtod(s, &end);
+        const char *units = "KMGT", *u;
+
+        if (end == s || v < 0)
+                return -EINVAL;
+        if (*end) {
+                if (end[1] || !(u = strchr(units, *end & ~0x20)))
+                        return -EINVAL;
+                for (const char *k = units; k <= u; k++)
+                        v *= 1024;
+        }
+        *bytes = v;
+        return 0;
+}
+
+static int do_fit(int argc, char **argv)
+{
+        struct cost_samples s = { 0 };
+        struct cost_model m;
+        const char *out = NULL;
+        int reason = -1, opt, err = 0;
+        /* -r applies to every -i, wherever it is on the line */
+        const char *lat[16], *sweep[16];
+        int nr_lat = 0, nr_sweep = 0;
+
+        while ((opt = getopt(argc, argv, "i:s:r:o:h")) != -1) {
+                switch (opt) {
+                case 'i':
+                case 's':
+                        if ((opt == 'i' ? nr_lat : nr_sweep) == 16) {
+                                fprintf(stderr, "at most 16 files of each kind\n");
+                                return 1;
+                        }
+                        if (opt == 'i')
+                                lat[nr_lat++] = optarg;
+                        else
+                                sweep[nr_sweep++] = optarg;
+                        break;
+                case 'r': reason = atoi(optarg); break;
+                case 'o': out = optarg; break;
+                default:
+                        usage();
+                        return opt == 'h' ? 0 : 1;
+                }
+        }
+        if (!nr_lat && !nr_sweep) {
+                usage();
+                return 1;
+        }
+
+        for (int i = 0; i < nr_lat + nr_sweep && err >= 0; i++) {
+                const char *path = i < nr_lat ? lat[i] : sweep[i - nr_lat];
+                err = i < nr_lat ? cost_load_migrate_lat(&s, path, reason) : cost_load_sweep(&s, path);
+                if (err < 0)
+                        fprintf(stderr, "%s: %s\n", path, strerror(-err));
+                else
+                        fprintf(stderr, "%s: %d samples\n", path, err);
+        }
+        if (err < 0)
+                goto out;
+        if ((err = cost_model_fit(&m, &s))) {
+                fprintf(stderr, "cannot fit %lu samples: %s\n", s.nr, strerror(-err));
+                goto out;
+        }
+        cost_model_print(stderr, &m);
+
+        FILE *f = out ? fopen(out, "w") : stdout;
+        if (!f) {
+                err = -errno;
+                perror(out);
+                goto out;
+        }
+        err = cost_model_save(&m, f);
+        if (out)
+                fclose(f);
+out:
+        cost_samples_free(&s);
+        return err < 0 ? 1 : 0;
+}
+
+static int do_predict(int argc, char **argv)
+{
+        struct cost_plan plan = { .concurrency = 1 };
+        struct cost_prediction p;
+        struct cost_model m;
+        const char *model = NULL;
+        double gate_ms = 0, call_gate_ms = 0;
+        unsigned int trials = 10000;
+        int opt, err;
+        FILE *f;
+
+        while ((opt = getopt(argc, argv, "m:H:b:c:t:g:G:h")) != -1) {
+                switch (opt) {
+                case 'm': model = optarg; break;
+                case 'H': plan.huge_frac = strtod(optarg, NULL) / 100; break;
+                case 'b': plan.batch = strtoul(optarg, NULL, 0); break;
+                case 'c': plan.concurrency = strtoul(optarg, NULL, 0); break;
+                case 't': trials = strtoul(optarg, NULL, 0); break;
+                case 'g': gate_ms = strtod(optarg, NULL); break;
+                case 'G': call_gate_ms = strtod(optarg, NULL); break;
+                default:
+                        usage();
+                        return opt == 'h' ? 0 : 1;
+                }
+        }
+        if (!model || optind != argc - 1 || parse_size(argv[optind], &plan.bytes)) {
+                usage();
+                return 1;
+        }
+
+        if (!(f = fopen(model, "r"))) {
+                perror(model);
+                return 1;
+        }
+        err = cost_model_load(&m, f);
+        fclose(f);
+        if (err) {
+                fprintf(stderr, "%s: not a cost model\n", model);
+                return 1;
+        }
+        if ((err = cost_model_predict(&m, &plan, trials, 0, &p))) {
+                fprintf(stderr, "predict: %s\n", strerror(-err));
+                return 1;
+        }
+
+        printf("%llu bytes, %.0f%% THP, %lu calls, %u concurrent\n", plan.bytes,
+               100 * plan.huge_frac, p.calls, plan.concurrency);
+        printf("total (ms): mean %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+               p.mean_ns / 1e6, p.p50_ns / 1e6, p.p90_ns / 1e6, p.p99_ns / 1e6, p.max_ns / 1e6);
+        printf("per call (ms): p50 %.3f  p99 %.3f\n", p.call_p50_ns / 1e6, p.call_p99_ns / 1e6);
+        printf("pages expected to fail: %.0f\n", p.failed_pages);
+
+        if (gate_ms > 0 && p.p99_ns > gate_ms * 1e6) {
+                printf("over budget: p99 %.3f ms > %.3f ms\n", p.p99_ns / 1e6, gate_ms);
+                return 2;
+        }
+        if (call_gate_ms > 0 && p.call_p99_ns > call_gate_ms * 1e6) {
+                printf("over budget: call p99 %.3f ms > %.3f ms\n", p.call_p99_ns / 1e6, call_gate_ms);
+                return 2;
+        }
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        prog = argv[0];
+        if (argc < 2) {
+                usage();
+                return 1;
+        }
+        /* subcommand options start after the subcommand */
+        if (!strcmp(argv[1], "fit"))
+                return do_fit(argc - 1, argv + 1);
+        if (!strcmp(argv[1], "predict"))
+                return do_predict(argc - 1, argv + 1);
+        usage();
+        return 1;
+}
@@ -0,0 +1,396 @@
+// The heat map behind hotpages and tierd: a count-min sketch of page faults
+// shared with hotpages.bpf.c, the per-region touched bitmaps it fills, and
+// an incremental page_idle scan of the target's address space.
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <bpf/bpf.h>
+#include "heatmap.h"
+
+#define PAGE_SIZE_4K            (1UL << HOT_PAGE_SHIFT)
+#define PM_PRESENT              (1ULL << 63)
+#define PM_PFN_MASK             ((1ULL << 55) - 1)
+#define SCAN_CHUNK              512
+
+/* ------------- Bounded min-heap of candidates ------------- */
+void heap_push(struct hot_heap *h, const struct hot_page *p)
+{
+        int i;
+
+        if (h->nr == h->cap) {
+                if (p->count <= h->v[0].count)
+                        return;
+                /* replace the root and sift down */
+                i = 0;
+                for (;;) {
+                        int c = 2 * i + 1;
+                        if (c >= h->nr)
+                                break;
+                        if (c + 1 < h->nr && h->v[c + 1].count < h->v[c].count)
+                                c++;
+                        if (h->v[c].count >= p->count)
+                                break;
+                        h->v[i] = h->v[c];
+                        i = c;
+                }
+                h->v[i] = *p;
+                return;
+        }
+        for (i = h->nr++; i > 0 && h->v[(i - 1) / 2].count > p->count; i = (i - 1) / 2)
+                h->v[i] = h->v[(i - 1) / 2];
+        h->v[i] = *p;
+}
+
+static int by_count_desc(const void *a, const void *b)
+{
+        const struct hot_page *x = a, *y = b;
+        return (y->count > x->count) - (y->count < x->count);
+}
+
+/* Turn the heap into an array sorted hottest first */
+void heap_sort(struct hot_heap *h)
+{
+        qsort(h->v, h->nr, sizeof(*h->v), by_count_desc);
+}
+
+static int by_count_addr(const void *a, const void *b)
+{
+        const struct hot_page *x = a, *y = b;
+        if (x->count != y->count)
+                return x->count < y->count ? -1 : 1;
+        return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static int by_addr(const void *a, const void *b)
+{
+        const struct hot_page *x = a, *y = b;
+        return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+/*
+ * The idle scan and the regions map can both offer a page in one epoch:
+ * merge such entries, keeping the higher count and either hint.  The
+ * result is sorted by address, no longer a heap; only heap_sort() or a
+ * plain walk may follow.
+ */
+void heap_dedup(struct hot_heap *h)
+{
+        int n = 0;
+
+        qsort(h->v, h->nr, sizeof(*h->v), by_addr);
+        for (int i = 0; i < h->nr; i++) {
+                if (n && h->v[n - 1].addr == h->v[i].addr) {
+                        struct hot_page *p = &h->v[n - 1];
+                        if (h->v[i].count > p->count)
+                                p->count = h->v[i].count;
+                        p->hint |= h->v[i].hint;
+                        continue;
+                }
+                h->v[n++] = h->v[i];
+        }
+        h->nr = n;
+}
+
+/* ------------- Count-min sketch shared with BPF through mmap ------------- */
+__u32 sketch_estimate(const struct sketch *s, __u64 page)
+{
+        __u32 min = ~0U;
+        for (__u32 row = 0; row < HOT_CMS_DEPTH; row++) {
+                __u32 v = s->c[hot_cms_slot(page, row, s->bits)];
+                if (v < min)
+                        min = v;
+        }
+        return min;
+}
+
+void sketch_add(struct sketch *s, __u64 page)
+{
+        for (__u32 row = 0; row < HOT_CMS_DEPTH; row++)
+                __sync_fetch_and_add(&s->c[hot_cms_slot(page, row, s->bits)], 1);
+}
+
+/* Halve every counter so the ranking follows the recent past.  Racing BPF
+ * increments can be lost, which only makes the estimate a little lower. */
+void sketch_decay(struct sketch *s)
+{
+        for (size_t i = 0; i < s->len; i++)
+                s->c[i] >>= 1;
+}
+
+/* Set the node of each of @pages, or -errno where it has none */
+int query_nodes(pid_t pid, struct hot_page *pages, int n)
+{
+        void *addrs[SCAN_CHUNK];
+        int status[SCAN_CHUNK];
+
+        for (int done = 0; done < n; done += SCAN_CHUNK) {
+                int nr = n - done < SCAN_CHUNK ? n - done : SCAN_CHUNK;
+                for (int i = 0; i < nr; i++)
+                        addrs[i] = (void *)(unsigned long)pages[done + i].addr;
+                if (syscall(SYS_move_pages, pid, nr, addrs, NULL, status, 0))
+                        return -errno;
+                for (int i = 0; i < nr; i++)
+                        pages[done + i].node = status[i];
+        }
+        return 0;
+}
+
+/* ------------- Incremental page_idle scan ------------- */
+int idle_scan_open(struct idle_scan *sc, pid_t pid, int cap)
+{
+        char path[64];
+
+        memset(sc, 0, sizeof(*sc));
+        snprintf(path, sizeof(path), "/proc/%d/pagemap", pid);
+        sc->pagemap_fd = open(path, O_RDONLY);
+        if (sc->pagemap_fd < 0)
+                return -errno;
+        sc->bitmap_fd = open("/sys/kernel/mm/page_idle/bitmap", O_RDWR);
+        if (sc->bitmap_fd < 0) {
+                int err = -errno;
+                close(sc->pagemap_fd);
+                return err;
+        }
+        sc->cold = calloc(cap, sizeof(*sc->cold));
+        if (!sc->cold) {
+                close(sc->pagemap_fd);
+                close(sc->bitmap_fd);
+                return -ENOMEM;
+        }
+        sc->cap_cold = cap;
+        sc->vma = -1;
+        return 0;
+}
+
+void idle_scan_close(struct idle_scan *sc)
+{
+        vma_list_free(&sc->vmas);
+        free(sc->cold);
+        close(sc->pagemap_fd);
+        close(sc->bitmap_fd);
+}
+
+/* Advance the cursor to the next scannable address, re-reading the maps
+ * (and starting a new pass) when the end of the address space is reached */
+static int idle_scan_next(struct idle_scan *sc, pid_t pid)
+{
+        for (int wrapped = 0; ; ) {
+                if (sc->vma >= 0 && sc->vma < sc->vmas.nr && sc->addr < sc->vmas.vmas[sc->vma].end)
+                        return 0;
+                if (sc->vma >= 0 && sc->vma < sc->vmas.nr) {
+                        sc->vma++;
+                } else {
+                        int err;
+                        if (wrapped++)
+                                return -ENOENT;         /* nothing to scan */
+                        if (sc->vma >= 0)
+                                sc->pass++;
+                        vma_list_free(&sc->vmas);
+                        err = proc_maps_read(pid, &sc->vmas);
+                        if (err)
+                                return err;
+                        sc->vma = 0;
+                }
+                while (sc->vma < sc->vmas.nr) {
+                        const struct vma_info *v = &sc->vmas.vmas[sc->vma];
+                        /* hugetlb pages are not tracked by page_idle */
+                        if (!vma_is_special(v) && v->page_size == PAGE_SIZE_4K)
+                                break;
+                        sc->vma++;
+                }
+                if (sc->vma < sc->vmas.nr)
+                        sc->addr = sc->vmas.vmas[sc->vma].start;
+        }
+}
+
+static void remember_cold(struct idle_scan *sc, const struct hot_page *p)
+{
+        sc->cold[sc->next_cold] = *p;
+        sc->next_cold = (sc->next_cold + 1) % sc->cap_cold;
+        if (sc->nr_cold < sc->cap_cold)
+                sc->nr_cold++;
+}
+
+/* A present page of the chunk being scanned, sorted by PFN to batch bitmap I/O */
+struct idle_pfn {
+        __u64 pfn;
+        __u64 addr;
+};
+
+static int by_pfn(const void *a, const void *b)
+{
+        const struct idle_pfn *x = a, *y = b;
+        return (x->pfn > y->pfn) - (x->pfn < y->pfn);
+}
+
+/*
+ * Look at up to @budget pages from the cursor on.  A page whose idle bit
+ * survived since the previous pass was not accessed in between: if it is
+ * on @local it becomes a cold candidate.  An accessed page is fed into the
+ * sketch like a fault would be and offered to @heap, which is how pages
+ * that are hot but no longer fault get ranked.  Every page is then marked
+ * idle again for the next pass.
+ *
+ * Reading a bitmap word makes the kernel walk the rmap of all 64 PFNs it
+ * covers, so the PFNs of a chunk are sorted and each word is read once,
+ * runs of adjacent words in one pread, and written back once with the
+ * marks of all its pages OR'ed together.
+ */
+int idle_scan_step(struct idle_scan *sc, pid_t pid, struct sketch *s,
+                          struct hot_heap *heap, unsigned long budget, int local)
+{
+        __u64 entries[SCAN_CHUNK], words[SCAN_CHUNK], marks[SCAN_CHUNK];
+        struct idle_pfn pfns[SCAN_CHUNK];
+        struct hot_page idle[SCAN_CHUNK];
+
+        sc->scanned = sc->idle = 0;
+        while (budget) {
+                int err = idle_scan_next(sc, pid);
+                if (err)
+                        return err == -ENOENT ? 0 : err;
+
+                unsigned long end = sc->vmas.vmas[sc->vma].end;
+                unsigned long n = (end - sc->addr) >> HOT_PAGE_SHIFT;
+                int nr_idle = 0, nr_pfns = 0;
+                ssize_t len;
+
+                if (n > SCAN_CHUNK)
+                        n = SCAN_CHUNK;
+                if (n > budget)
+                        n = budget;
+                len = pread(sc->pagemap_fd, entries, n * sizeof(__u64),
+                            (sc->addr >> HOT_PAGE_SHIFT) * sizeof(__u64));
+                if (len < 0)
+                        return -errno;
+                n = len / sizeof(__u64);
+                if (!n) {
+                        sc->addr = end;         /* VMA vanished under us */
+                        continue;
+                }
+
+                for (unsigned long i = 0; i < n; i++) {
+                        __u64 pfn = entries[i] & PM_PFN_MASK;
+
+                        if (!(entries[i] & PM_PRESENT))
+                                continue;
+                        if (!pfn) {
+                                sc->no_pfn = true;
+                                continue;
+                        }
+                        pfns[nr_pfns++] = (struct idle_pfn){ pfn, sc->addr + (i << HOT_PAGE_SHIFT) };
+                }
+                qsort(pfns, nr_pfns, sizeof(*pfns), by_pfn);
+
+                for (int i = 0, j; i < nr_pfns; i = j) {
+                        __u64 first = pfns[i].pfn / 64, last = first;
+                        size_t have;
+
+                        /* a run of adjacent words, no gaps: each read word costs rmap walks */
+                        for (j = i; j < nr_pfns; j++) {
+                                __u64 w = pfns[j].pfn / 64;
+                                if (w > last + 1 || w - first >= SCAN_CHUNK)
+                                        break;
+                                last = w;
+                        }
+                        len = pread(sc->bitmap_fd, words, (last - first + 1) * sizeof(__u64),
+                                    first * sizeof(__u64));
+                        have = len > 0 ? len / sizeof(__u64) : 0;      /* past the last PFN */
+                        memset(marks, 0, have * sizeof(__u64));
+
+                        for (int k = i; k < j; k++) {
+                                __u64 w = pfns[k].pfn / 64 - first, bit = 1ULL << (pfns[k].pfn % 64);
+                                __u64 addr = pfns[k].addr;
+
+                                if (w >= have)
+                                        continue;
+                                sc->scanned++;
+                                if (sc->pass) {
+                                        if (words[w] & bit) {
+                                                idle[nr_idle++] = (struct hot_page){ .addr = addr };
+                                                sc->idle++;
+                                        } else {
+                                                struct hot_page p = { .addr = addr };
+                                                sketch_add(s, addr >> HOT_PAGE_SHIFT);
+                                                p.count = sketch_estimate(s, addr >> HOT_PAGE_SHIFT);
+                                                heap_push(heap, &p);
+                                        }
+                                }
+                                marks[w] |= bit;
+                        }
+                        /* zero words set nothing */
+                        if (have)
+                                pwrite(sc->bitmap_fd, marks, have * sizeof(__u64), first * sizeof(__u64));
+                }
+
+                if (nr_idle && !query_nodes(pid, idle, nr_idle)) {
+                        for (int i = 0; i < nr_idle; i++) {
+                                if (idle[i].node == local)
+                                        remember_cold(sc, &idle[i]);
+                        }
+                }
+                sc->addr += n << HOT_PAGE_SHIFT;
+                budget -= n;
+        }
+        return 0;
+}
+
+/*
+ * Drop cold candidates touched since they were found idle, and keep one
+ * entry of a page found idle on more than one pass.  Leaves the rest sorted
+ * by address and returns how many there are.
+ */
+int idle_scan_prune(struct idle_scan *sc, const struct sketch *s)
+{
+        int nr = 0;
+
+        for (int i = 0; i < sc->nr_cold; i++)
+                sc->cold[i].count = sketch_estimate(s, sc->cold[i].addr >> HOT_PAGE_SHIFT);
+        qsort(sc->cold, sc->nr_cold, sizeof(*sc->cold), by_count_addr);
+        for (int i = 0; i < sc->nr_cold && !sc->cold[i].count; i++) {
+                if (!nr || sc->cold[i].addr != sc->cold[nr - 1].addr)
+                        sc->cold[nr++] = sc->cold[i];
+        }
+        sc->nr_cold = nr;
+        sc->next_cold = nr % sc->cap_cold;
+        return nr;
+}
+
+/* ------------- Draining the regions map ------------- */
+/*
+ * Pop every region flagged since the last epoch and push its touched pages
+ * into @heap.  Always take the first key so that deleting as we go is safe;
+ * @max bounds the loop against a target that keeps faulting meanwhile.
+ */
+int drain_regions(int fd, const struct sketch *s, struct hot_heap *heap,
+                         struct epoch_stats *st, __u32 max)
+{
+        struct region_stat r;
+        __u64 region;
+
+        memset(st, 0, sizeof(*st));
+        while (st->regions < max && !bpf_map_get_next_key(fd, NULL, &region)) {
+                if (bpf_map_lookup_elem(fd, &region, &r) || bpf_map_delete_elem(fd, &region))
+                        return -errno;
+                st->regions++;
+                st->faults += r.faults;
+                st->hints  += r.hints;
+                for (int w = 0; w < HOT_REGION_WORDS; w++) {
+                        for (__u64 bits = r.touched[w]; bits; bits &= bits - 1) {
+                                int b = __builtin_ctzll(bits);
+                                __u64 page = (region << (HOT_REGION_SHIFT - HOT_PAGE_SHIFT)) + w * 64 + b;
+                                struct hot_page p = {
+                                        .addr  = page << HOT_PAGE_SHIFT,
+                                        .count = sketch_estimate(s, page),
+                                        .hint  = !!(r.hinted[w] & (1ULL << b)),
+                                };
+                                heap_push(heap, &p);
+                                st->pages++;
+                        }
+                }
+        }
+        return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef __HEATMAP_H
+#define __HEATMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/types.h>
+#include "hotpages.h"
+#include "page_migrations/proc_maps.h"
+
+struct hot_page {
+        __u64 addr;
+        __u32 count;            /* count-min estimate of faults */
+        __u32 hint;             /* took a NUMA hinting fault this epoch */
+        int node;
+};
+
+/* Bounded min-heap on count: keeps the @cap hottest pages of an epoch */
+struct hot_heap {
+        struct hot_page *v;
+        int nr, cap;
+};
+
+void heap_push(struct hot_heap *h, const struct hot_page *p);
+void heap_sort(struct hot_heap *h);
+void heap_dedup(struct hot_heap *h);
+
+/* ------------- Count-min sketch shared with BPF through mmap ------------- */
+struct sketch {
+        volatile __u32 *c;
+        __u32 bits;
+        size_t len;             /* counters */
+};
+
+__u32 sketch_estimate(const struct sketch *s, __u64 page);
+void sketch_add(struct sketch *s, __u64 page);
+void sketch_decay(struct sketch *s);
+
+int query_nodes(pid_t pid, struct hot_page *pages, int n);
+
+/* ------------- Incremental page_idle scan ------------- */
+struct idle_scan {
+        int pagemap_fd;
+        int bitmap_fd;
+        struct vma_list vmas;
+        int vma;                        /* cursor: VMA index and address in it */
+        unsigned long addr;
+        unsigned long pass;             /* completed walks of the address space */
+        unsigned long scanned;          /* present pages looked at this epoch */
+        unsigned long idle;
+        bool no_pfn;                    /* pagemap hides PFNs: no CAP_SYS_ADMIN */
+        struct hot_page *cold;          /* ring of idle local pages */
+        int nr_cold, cap_cold, next_cold;
+};
+
+int idle_scan_open(struct idle_scan *sc, pid_t pid, int cap);
+void idle_scan_close(struct idle_scan *sc);
+int idle_scan_step(struct idle_scan *sc, pid_t pid, struct sketch *s,
+                   struct hot_heap *heap, unsigned long budget, int local);
+int idle_scan_prune(struct idle_scan *sc, const struct sketch *s);
+
+/* ------------- Draining the regions map ------------- */
+struct epoch_stats {
+        __u64 faults;
+        __u64 hints;
+        __u64 regions;
+        __u64 pages;
+};
+
+int drain_regions(int fd, const struct sketch *s, struct hot_heap *heap,
+                  struct epoch_stats *st, __u32 max);
+
+#endif /* __HEATMAP_H */
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "vmlinux.h"
+#include "hotpages.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+
+/* ------------- Set by userland before load ------------- */
+const volatile u32 target_tgid = 0;
+const volatile u32 cms_bits    = 16;
+
+/* -------- BPF maps, sized by userland with bpf_map__set_max_entries -------- */
+struct {
+        __uint(type, BPF_MAP_TYPE_LRU_HASH);
+        __uint(max_entries, 65536);
+        __type(key, u64);                       /* address >> HOT_REGION_SHIFT */
+        __type(value, struct region_stat);
+} regions SEC(".maps");
+
+struct {
+        __uint(type, BPF_MAP_TYPE_ARRAY);
+        __uint(map_flags, BPF_F_MMAPABLE);
+        __uint(max_entries, HOT_CMS_DEPTH << 16);
+        __type(key, u32);
+        __type(value, u32);
+} cms SEC(".maps");
+
+/* ---------- Helpers ---------- */
+static __always_inline void cms_add(u64 page)
+{
+        #pragma unroll
+        for (u32 row = 0; row < HOT_CMS_DEPTH; row++) {
+                u32 slot = hot_cms_slot(page, row, cms_bits);
+                u32 *c   = bpf_map_lookup_elem(&cms, &slot);
+                if (c)
+                        __sync_fetch_and_add(c, 1);
+        }
+}
+
+static __always_inline void record(u64 address, bool hint)
+{
+        u64 region = address >> HOT_REGION_SHIFT;
+        u32 idx    = (address >> HOT_PAGE_SHIFT) & (HOT_REGION_PAGES - 1);
+        u64 bit    = 1ULL << (idx & 63);
+        struct region_stat *r;
+
+        r = bpf_map_lookup_elem(&regions, &region);
+        if (!r) {
+                struct region_stat zero = {};
+                bpf_map_update_elem(&regions, &region, &zero, BPF_NOEXIST);
+                r = bpf_map_lookup_elem(&regions, &region);
+                if (!r)
+                        return;
+        }
+
+        /* Bitmaps are updated racily: a lost bit only costs one sample */
+        r->touched[idx / 64] |= bit;
+        if (hint) {
+                /* handle_fault already counted this fault, here and in the sketch */
+                r->hinted[idx / 64] |= bit;
+                __sync_fetch_and_add(&r->hints, 1);
+                return;
+        }
+        __sync_fetch_and_add(&r->faults, 1);
+        cms_add(address >> HOT_PAGE_SHIFT);
+}
+
+static __always_inline bool is_target(void)
+{
+        return (bpf_get_current_pid_tgid() >> 32) == target_tgid;
+}
+
+/* ---------- every fault of the target, NUMA hinting faults included ---------- */
+SEC("kprobe/handle_mm_fault")
+int BPF_KPROBE(handle_fault, struct vm_area_struct *vma, unsigned long address)
+{
+        if (is_target())
+                record(address, false);
+        return 0;
+}
+
+/* ---------- which of those were NUMA hinting faults, on base pages and THPs ---------- */
+SEC("kprobe/do_numa_page")
+int BPF_KPROBE(handle_numa_page, struct vm_fault *vmf)
+{
+        if (is_target())
+                record(BPF_CORE_READ(vmf, address), true);
+        return 0;
+}
+
+SEC("kprobe/do_huge_pmd_numa_page")
+int BPF_KPROBE(handle_huge_pmd_numa_page, struct vm_fault *vmf)
+{
+        if (is_target())
+                record(BPF_CORE_READ(vmf, address), true);
+        return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
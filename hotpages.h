@@ -0,0 +1,34 @@
+#ifndef __HOTPAGES_H
+#define __HOTPAGES_H
+
+/* ------------- Geometry of the heat map ------------- */
+#define HOT_PAGE_SHIFT          12
+#define HOT_REGION_SHIFT        21      /* 2 MB regions */
+#define HOT_REGION_PAGES        (1 << (HOT_REGION_SHIFT - HOT_PAGE_SHIFT))
+#define HOT_REGION_WORDS        (HOT_REGION_PAGES / 64)
+
+/* ------------- Count-min sketch of per-page fault counts ------------- */
+#define HOT_CMS_DEPTH           4
+#define HOT_CMS_SEED0           0x9e3779b97f4a7c15ULL
+#define HOT_CMS_SEED1           0xc2b2ae3d27d4eb4fULL
+#define HOT_CMS_SEED2           0x165667b19e3779f9ULL
+#define HOT_CMS_SEED3           0xd6e8feb86659fd93ULL
+
+/* Slot of @page in row @row of a sketch with 2^@bits counters per row */
+static inline __u32 hot_cms_slot(__u64 page, __u32 row, __u32 bits)
+{
+        __u64 seed = row == 0 ? HOT_CMS_SEED0 :
+                     row == 1 ? HOT_CMS_SEED1 :
+                     row == 2 ? HOT_CMS_SEED2 : HOT_CMS_SEED3;
+        return (row << bits) | (__u32)((page * seed) >> (64 - bits));
+}
+
+/* ------------- Per-region value of the regions map ------------- */
+struct region_stat {
+        __u64 touched[HOT_REGION_WORDS];        /* pages that faulted this epoch */
+        __u64 hinted[HOT_REGION_WORDS];         /* pages that took a NUMA hinting fault */
+        __u32 faults;
+        __u32 hints;
+};
+
+#endif /* __HOTPAGES_H */
@@ -0,0 +1,202 @@
+// Per-process page heat map: which pages of a running process are hot but
+// sit on a remote node, and which local pages have gone cold.
+//
+// The BPF side counts the page faults of the target in a count-min sketch
+// and flags the touched pages of each 2 MB region, and among them the ones
+// that took a NUMA hinting fault.
+// Every epoch the regions are drained, the hottest pages are looked up with
+// move_pages() and the remote ones are ranked.  With -I, the address space
+// is also walked incrementally through /proc/<pid>/pagemap and the page_idle
+// bitmap, a few pages per epoch, to find local pages nobody touched since
+// the previous pass.
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <bpf/libbpf.h>
+#include "heatmap.h"
+#include "hotpages.skel.h"
+
+static volatile bool stop = false;
+static void handle_int(int sig) { stop = true; }
+
+static void print_hot_remote(struct hot_heap *heap, int top, int local)
+{
+        int shown = 0;
+
+        heap_sort(heap);
+        printf("hot remote pages (local node %d):\n", local);
+        printf("  %-18s %8s %5s %5s\n", "ADDR", "FAULTS", "HINT", "NODE");
+        for (int i = 0; i < heap->nr && shown < top; i++) {
+                const struct hot_page *p = &heap->v[i];
+                if (p->node < 0 || p->node == local)
+                        continue;
+                printf("  0x%016llx %8u %5s %5d\n", p->addr, p->count, p->hint ? "yes" : "", p->node);
+                shown++;
+        }
+        if (!shown)
+                printf("  (none)\n");
+}
+
+static void print_cold_local(struct idle_scan *sc, const struct sketch *s, int top, int local)
+{
+        int shown = 0;
+
+        idle_scan_prune(sc, s);
+
+        printf("cold local pages (node %d, pass %lu, %lu/%lu scanned pages idle):\n",
+               local, sc->pass, sc->idle, sc->scanned);
+        for (int i = 0; i < sc->nr_cold && shown < top; i++) {
+                printf("  0x%016llx\n", sc->cold[i].addr);
+                shown++;
+        }
+        if (!shown)
+                printf("  (none%s)\n", sc->pass ? "" : " yet, first pass only marks pages idle");
+}
+
+static void usage(const char *prog)
+{
+        fprintf(stderr,
+                "Usage: %s -p <pid> [-L local-node] [-i secs] [-n epochs] [-k top]\n"
+                "          [-w sketch-bits] [-r max-regions] [-I] [-S scan-pages]\n"
+                "  -L  node the target's pages should live on (default 0)\n"
+                "  -i  epoch length in seconds (default 1)\n"
+                "  -n  number of epochs, 0 runs until ^C (default 0)\n"
+                "  -k  pages listed per ranking (default 20)\n"
+                "  -w  log2 of the counters per sketch row (default 16)\n"
+                "  -r  2 MB regions tracked per epoch (default 65536)\n"
+                "  -I  also scan page_idle for cold pages (needs CAP_SYS_ADMIN)\n"
+                "  -S  pages scanned per epoch with -I (default 262144)\n",
+                prog);
+}
+
+int main(int argc, char **argv)
+{
+        int pid = -1, local = 0, top = 20, idle = 0;
+        unsigned int interval = 1, epochs = 0;
+        __u32 bits = 16, max_regions = 65536;
+        unsigned long scan_pages = 262144;
+        struct idle_scan sc;
+        struct sketch s;
+        struct hot_heap heap;
+        int opt, err;
+
+        while ((opt = getopt(argc, argv, "p:L:i:n:k:w:r:IS:h")) != -1) {
+                switch (opt) {
+                case 'p': pid = atoi(optarg); break;
+                case 'L': local = atoi(optarg); break;
+                case 'i': interval = strtoul(optarg, NULL, 0); break;
+                case 'n': epochs = strtoul(optarg, NULL, 0); break;
+                case 'k': top = atoi(optarg); break;
+                case 'w': bits = strtoul(optarg, NULL, 0); break;
+                case 'r': max_regions = strtoul(optarg, NULL, 0); break;
+                case 'I': idle = 1; break;
+                case 'S': scan_pages = strtoul(optarg, NULL, 0); break;
+                default:
+                        usage(argv[0]);
+                        return opt == 'h' ? 0 : 1;
+                }
+        }
+        if (pid <= 0 || top <= 0 || !interval || bits < 8 || bits > 24 || !max_regions) {
+                usage(argv[0]);
+                return 1;
+        }
+
+        struct hotpages_bpf *skel = hotpages_bpf__open();
+        if (!skel) { perror("open"); return 1; }
+
+        skel->rodata->target_tgid = pid;
+        skel->rodata->cms_bits = bits;
+        bpf_map__set_max_entries(skel->maps.regions, max_regions);
+        bpf_map__set_max_entries(skel->maps.cms, HOT_CMS_DEPTH << bits);
+        if (hotpages_bpf__load(skel)) {
+                fprintf(stderr, "load failed\n");
+                hotpages_bpf__destroy(skel);
+                return 1;
+        }
+
+        /* Hinting fault handlers are static and may be inlined or absent */
+        skel->links.handle_fault = bpf_program__attach(skel->progs.handle_fault);
+        if (!skel->links.handle_fault) {
+                fprintf(stderr, "attach handle_mm_fault failed\n");
+                hotpages_bpf__destroy(skel);
+                return 1;
+        }
+        skel->links.handle_numa_page = bpf_program__attach(skel->progs.handle_numa_page);
+        skel->links.handle_huge_pmd_numa_page = bpf_program__attach(skel->progs.handle_huge_pmd_numa_page);
+        if (!skel->links.handle_numa_page)
+                fprintf(stderr, "warning: do_numa_page not probed, hinting faults not flagged\n");
+
+        s.bits = bits;
+        s.len = (size_t)HOT_CMS_DEPTH << bits;
+        s.c = mmap(NULL, s.len * sizeof(__u32), PROT_READ | PROT_WRITE, MAP_SHARED,
+                   bpf_map__fd(skel->maps.cms), 0);
+        if (s.c == MAP_FAILED) {
+                perror("mmap sketch");
+                hotpages_bpf__destroy(skel);
+                return 1;
+        }
+
+        heap.cap = top * 8 < 256 ? 256 : top * 8;
+        heap.v = calloc(heap.cap, sizeof(*heap.v));
+        if (!heap.v) {
+                perror("calloc");
+                munmap((void *)s.c, s.len * sizeof(__u32));
+                hotpages_bpf__destroy(skel);
+                return 1;
+        }
+
+        if (idle && (err = idle_scan_open(&sc, pid, heap.cap))) {
+                fprintf(stderr, "page_idle scan disabled: %s\n", strerror(-err));
+                idle = 0;
+        }
+
+        printf("pid %d: %u regions x %zu B heat map, %zu KB sketch, %d candidates/epoch\n",
+               pid, max_regions, sizeof(struct region_stat),
+               s.len * sizeof(__u32) / 1024, heap.cap);
+        fflush(stdout);         /* attached: bench.sh waits for this line */
+
+        signal(SIGINT, handle_int);
+        signal(SIGTERM, handle_int);
+
+        for (unsigned int epoch = 1; !stop && (!epochs || epoch <= epochs); epoch++) {
+                struct epoch_stats st;
+
+                sleep(interval);
+                heap.nr = 0;
+                if (idle && (err = idle_scan_step(&sc, pid, &s, &heap, scan_pages, local))) {
+                        fprintf(stderr, "page_idle scan: %s\n", strerror(-err));
+                        break;
+                }
+                if ((err = drain_regions(bpf_map__fd(skel->maps.regions), &s, &heap, &st, max_regions))) {
+                        fprintf(stderr, "reading regions: %s\n", strerror(-err));
+                        break;
+                }
+                heap_dedup(&heap);
+                if (heap.nr && (err = query_nodes(pid, heap.v, heap.nr))) {
+                        fprintf(stderr, "move_pages: %s\n", strerror(-err));
+                        break;
+                }
+
+                printf("\nepoch %u: %llu faults (%llu hinting), %llu pages touched in %llu regions\n",
+                       epoch, st.faults, st.hints, st.pages, st.regions);
+                print_hot_remote(&heap, top, local);
+                if (idle) {
+                        if (sc.no_pfn)
+                                printf("warning: pagemap shows no PFNs, run as root for -I\n");
+                        print_cold_local(&sc, &s, top, local);
+                }
+                fflush(stdout);
+                sketch_decay(&s);
+        }
+
+        if (idle)
+                idle_scan_close(&sc);
+        free(heap.v);
+        munmap((void *)s.c, s.len * sizeof(__u32));
+        hotpages_bpf__destroy(skel);
+        return 0;
+}
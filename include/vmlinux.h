@@ -0,0 +1,205 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * The few kernel types the BPF programs of this repo use, written by hand so
+ * that the build needs neither the host's BTF nor its kernel headers.
+ *
+ * Every struct is compiled with preserve_access_index: field accesses are
+ * CO-RE relocations that libbpf resolves against the running kernel's BTF at
+ * load time, so only the names and types of the fields used matter, not
+ * their order or the members left out.  The exceptions are the pt_regs
+ * layouts, which are the kprobe context and fixed by the ABI.
+ *
+ * A program that needs more types can still be built against a full dump:
+ *   bpftool btf dump file /sys/kernel/btf/vmlinux format c > vmlinux.h
+ */
+#ifndef __VMLINUX_H__
+#define __VMLINUX_H__
+
+/* ------------- Scalar types ------------- */
+typedef signed char __s8;
+typedef unsigned char __u8;
+typedef short __s16;
+typedef unsigned short __u16;
+typedef int __s32;
+typedef unsigned int __u32;
+typedef long long __s64;
+typedef unsigned long long __u64;
+
+typedef __s8 s8;
+typedef __u8 u8;
+typedef __s16 s16;
+typedef __u16 u16;
+typedef __s32 s32;
+typedef __u32 u32;
+typedef __s64 s64;
+typedef __u64 u64;
+
+typedef __u16 __le16;
+typedef __u16 __be16;
+typedef __u32 __le32;
+typedef __u32 __be32;
+typedef __u64 __le64;
+typedef __u64 __be64;
+typedef __u32 __wsum;
+typedef __u16 __sum16;
+
+typedef _Bool bool;
+enum {
+        false = 0,
+        true = 1,
+};
+
+typedef int __kernel_pid_t;
+typedef __kernel_pid_t pid_t;
+
+/* ------------- BPF UAPI used by the map definitions ------------- */
+enum bpf_map_type {
+        BPF_MAP_TYPE_HASH = 1,
+        BPF_MAP_TYPE_ARRAY = 2,
+        BPF_MAP_TYPE_LRU_HASH = 9,
+        BPF_MAP_TYPE_RINGBUF = 27,
+};
+
+enum {
+        BPF_ANY = 0,
+        BPF_NOEXIST = 1,
+        BPF_EXIST = 2,
+};
+
+enum {
+        BPF_F_MMAPABLE = 1024,
+};
+
+#ifndef BPF_NO_PRESERVE_ACCESS_INDEX
+#pragma clang attribute push (__attribute__((preserve_access_index)), apply_to = record)
+#endif
+
+/* ------------- kprobe context ------------- */
+#if defined(__TARGET_ARCH_x86)
+struct pt_regs {
+        long unsigned int r15;
+        long unsigned int r14;
+        long unsigned int r13;
+        long unsigned int r12;
+        long unsigned int bp;
+        long unsigned int bx;
+        long unsigned int r11;
+        long unsigned int r10;
+        long unsigned int r9;
+        long unsigned int r8;
+        long unsigned int ax;
+        long unsigned int cx;
+        long unsigned int dx;
+        long unsigned int si;
+        long unsigned int di;
+        long unsigned int orig_ax;
+        long unsigned int ip;
+        long unsigned int cs;
+        long unsigned int flags;
+        long unsigned int sp;
+        long unsigned int ss;
+};
+#elif defined(__TARGET_ARCH_arm64)
+struct user_pt_regs {
+        __u64 regs[31];
+        __u64 sp;
+        __u64 pc;
+        __u64 pstate;
+};
+
+struct pt_regs {
+        union {
+                struct user_pt_regs user_regs;
+                struct {
+                        u64 regs[31];
+                        u64 sp;
+                        u64 pc;
+                        u64 pstate;
+                };
+        };
+        u64 orig_x0;
+        s32 syscallno;
+        u32 unused2;
+        u64 sdei_ttbr1;
+        u64 pmr_save;
+        u64 stackframe[2];
+        u64 lockdep_hardirqs;
+        u64 exit_rcu;
+};
+#else
+#error "include/vmlinux.h: pt_regs only for __TARGET_ARCH_x86 and __TARGET_ARCH_arm64"
+#endif
+
+/* ------------- mm ------------- */
+struct vm_area_struct;
+
+struct vm_fault {
+        long unsigned int address;      /* faulting address, page aligned */
+};
+
+enum migrate_mode {
+        MIGRATE_ASYNC = 0,
+        MIGRATE_SYNC_LIGHT = 1,
+        MIGRATE_SYNC = 2,
+        MIGRATE_SYNC_NO_COPY = 3,
+};
+
+/* ------------- Tracepoint records ------------- */
+struct trace_entry {
+        short unsigned int type;
+        unsigned char flags;
+        unsigned char preempt_count;
+        int pid;
+};
+
+struct trace_event_raw_mm_migrate_pages_start {
+        struct trace_entry ent;
+        enum migrate_mode mode;
+        int reason;
+        char __data[0];
+};
+
+struct trace_event_raw_mm_migrate_pages {
+        struct trace_entry ent;
+        long unsigned int succeeded;
+        long unsigned int failed;
+        long unsigned int thp_succeeded;
+        long unsigned int thp_failed;
+        long unsigned int thp_split;
+        enum migrate_mode mode;
+        int reason;
+        char __data[0];
+};
+
+struct trace_event_raw_sched_move_numa {
+        struct trace_entry ent;
+        pid_t pid;
+        pid_t tgid;
+        pid_t ngid;
+        int src_cpu;
+        int src_nid;
+        int dst_cpu;
+        int dst_nid;
+        char __data[0];
+};
+
+struct trace_event_raw_sched_numa_pair_template {
+        struct trace_entry ent;
+        pid_t src_pid;
+        pid_t src_tgid;
+        pid_t src_ngid;
+        int src_cpu;
+        int src_nid;
+        pid_t dst_pid;
+        pid_t dst_tgid;
+        pid_t dst_ngid;
+        int dst_cpu;
+        int dst_nid;
+        char __data[0];
+};
+
+#ifndef BPF_NO_PRESERVE_ACCESS_INDEX
+#pragma clang attribute pop
+#endif
+
+#endif /* __VMLINUX_H__ */
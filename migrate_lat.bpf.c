@@ -7,11 +7,25 @@
 
 /* ------------- Key for the start-timestamp hash ------------- */
 struct start_key {
-        u32  pid;
+        u32  tid;         /* threads of a process migrate concurrently */
         u64  cgroup_id;   /* helps when the same task nests containers */
 };
 
-/* -------- BPF maps -------- */
+/* ------------- task_numa_fault() flags, kernel/sched/sched.h ------------- */
+#define TNF_MIGRATED            0x01
+#define TNF_FAULT_LOCAL         0x08
+#define TNF_MIGRATE_FAIL        0x10
+#define MR_NUMA_MISPLACED       5
+
+/* ------------- Set by userland before load ------------- */
+const volatile u32  numa_tgid   = 0;    /* 0: every task */
+const volatile bool emit_events = true; /* per-call events to the ring buffer */
+const volatile bool numa_stats  = false;/* per-task NUMA balancing counters */
+
+/* Migrations between their start and end tracepoints, all tasks */
+u64 inflight = 0;
+
+/* -------- BPF maps, resized by userland with bpf_map__set_max_entries -------- */
 struct {
         __uint(type, BPF_MAP_TYPE_HASH);
         __uint(max_entries, 8192);
@@ -19,6 +33,13 @@ struct {
         __type(value, u64);             /* start timestamp */
 } starts SEC(".maps");
 
+struct {
+        __uint(type, BPF_MAP_TYPE_HASH);
+        __uint(max_entries, 4096);
+        __type(key, u32);               /* tgid */
+        __type(value, struct numa_task);
+} numa_tasks SEC(".maps");
+
 struct {
         __uint(type, BPF_MAP_TYPE_RINGBUF);
         __uint(max_entries, 1 << 24);
@@ -28,11 +49,32 @@ struct {
 static __always_inline struct start_key make_key(void)
 {
         struct start_key k = {};
-        k.pid        = bpf_get_current_pid_tgid() >> 32;
+        k.tid        = (u32)bpf_get_current_pid_tgid();
         k.cgroup_id  = bpf_get_current_cgroup_id();
         return k;
 }
 
+/* Counters of @tgid, created on first use; NULL when filtered out */
+static __always_inline struct numa_task *numa_task(u32 tgid)
+{
+        struct numa_task *t;
+
+        if (numa_tgid && tgid != numa_tgid)
+                return NULL;
+        t = bpf_map_lookup_elem(&numa_tasks, &tgid);
+        if (!t) {
+                struct numa_task zero = {};
+                bpf_map_update_elem(&numa_tasks, &tgid, &zero, BPF_NOEXIST);
+                t = bpf_map_lookup_elem(&numa_tasks, &tgid);
+                if (!t)
+                        return NULL;
+        }
+        /* sched events may run in another task's context */
+        if (!t->comm[0] && tgid == bpf_get_current_pid_tgid() >> 32)
+                bpf_get_current_comm(t->comm, sizeof(t->comm));
+        return t;
+}
+
 /* ---------- kprobe entry: remember T0 ---------- */
 // SEC("kprobe/migrate_pages")
 // int BPF_KPROBE(handle_migrate_pages_entry)
@@ -47,7 +89,10 @@ SEC("tp/migrate/mm_migrate_pages_start")
 int handle_mm_migrate_pages_start(struct trace_event_raw_mm_migrate_pages_start *ctx) {
         struct start_key k   = make_key();
         u64 ts               = bpf_ktime_get_ns();
-        bpf_map_update_elem(&starts, &k, &ts, BPF_ANY);
+        /* a start without an end (e.g. an early error) is overwritten, not counted twice */
+        bool nested          = bpf_map_lookup_elem(&starts, &k) != NULL;
+        if (bpf_map_update_elem(&starts, &k, &ts, BPF_ANY) == 0 && !nested)
+                __sync_fetch_and_add(&inflight, 1);
         return 0;
 }
 
@@ -99,22 +144,95 @@ int handle_mm_migrate_pages(struct trace_event_raw_mm_migrate_pages *ctx)
                 return 0;                       /* unmatched – ignore */
 
         u64 delta            = bpf_ktime_get_ns() - *tsp;
+        u32 tgid             = bpf_get_current_pid_tgid() >> 32;
+        u32 depth            = inflight;
         bpf_map_delete_elem(&starts, &k);
-
+        __sync_fetch_and_add(&inflight, -1);
+
+        /* NUMA balancing migrates in the context of the faulting task */
+        if (numa_stats && ctx->reason == MR_NUMA_MISPLACED) {
+                struct numa_task *t = numa_task(tgid);
+                if (t) {
+                        __sync_fetch_and_add(&t->mig_calls, 1);
+                        __sync_fetch_and_add(&t->mig_pages_ok, ctx->succeeded);
+                        __sync_fetch_and_add(&t->mig_pages_failed, ctx->failed);
+                        __sync_fetch_and_add(&t->mig_ns, delta);
+                }
+        }
+
+        if (!emit_events)
+                return 0;
         struct lat_event *e  = bpf_ringbuf_reserve(&events, sizeof(*e), 0);
         if (!e)
                 return 0;
 
-        e->pid          = k.pid;
+        e->pid          = tgid;
         e->delta_ns     = delta;
         e->pages_ok     = ctx->succeeded;
         e->pages_failed = ctx->failed;
         e->mode         = ctx->mode;
         e->reason       = ctx->reason;
+        e->thp_ok       = bpf_core_field_exists(ctx->thp_succeeded) ? ctx->thp_succeeded : 0;
+        e->thp_failed   = bpf_core_field_exists(ctx->thp_failed) ? ctx->thp_failed : 0;
+        e->inflight     = depth;
         bpf_get_current_comm(&e->comm, sizeof(e->comm));
 
         bpf_ringbuf_submit(e, 0);
         return 0;
 }
 
+/* ---------- every NUMA hinting fault ends in task_numa_fault() ---------- */
+/* "?": not loaded unless userland asks for the NUMA balancing report */
+SEC("?kprobe/task_numa_fault")
+int BPF_KPROBE(handle_task_numa_fault, int last_cpupid, int mem_node, int pages, int flags)
+{
+        struct numa_task *t = numa_task(bpf_get_current_pid_tgid() >> 32);
+        if (!t)
+                return 0;
+
+        if (flags & TNF_FAULT_LOCAL) {
+                __sync_fetch_and_add(&t->faults_local, 1);
+                __sync_fetch_and_add(&t->pages_local, pages);
+        } else {
+                __sync_fetch_and_add(&t->faults_remote, 1);
+                __sync_fetch_and_add(&t->pages_remote, pages);
+        }
+        if (flags & TNF_MIGRATED)
+                __sync_fetch_and_add(&t->fault_migrated, pages);
+        if (flags & TNF_MIGRATE_FAIL)
+                __sync_fetch_and_add(&t->fault_migrate_failed, pages);
+        return 0;
+}
+
+/* ---------- task placement by the NUMA balancer ---------- */
+SEC("?tp/sched/sched_move_numa")
+int handle_sched_move_numa(struct trace_event_raw_sched_move_numa *ctx)
+{
+        struct numa_task *t = numa_task(ctx->tgid);
+        if (t)
+                __sync_fetch_and_add(&t->task_moves, 1);
+        return 0;
+}
+
+SEC("?tp/sched/sched_swap_numa")
+int handle_sched_swap_numa(struct trace_event_raw_sched_numa_pair_template *ctx)
+{
+        struct numa_task *t = numa_task(ctx->src_tgid);
+        if (t)
+                __sync_fetch_and_add(&t->task_swaps, 1);
+        t = numa_task(ctx->dst_tgid);
+        if (t)
+                __sync_fetch_and_add(&t->task_swaps, 1);
+        return 0;
+}
+
+SEC("?tp/sched/sched_stick_numa")
+int handle_sched_stick_numa(struct trace_event_raw_sched_numa_pair_template *ctx)
+{
+        struct numa_task *t = numa_task(ctx->src_tgid);
+        if (t)
+                __sync_fetch_and_add(&t->task_sticks, 1);
+        return 0;
+}
+
 char LICENSE[] SEC("license") = "GPL";
\ No newline at end of file
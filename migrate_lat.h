@@ -7,9 +7,30 @@ struct lat_event {
     __u32 pid;
     __u64 delta_ns;
     __u64 pages_ok;
-    __u64 pages_failed;
+    __u64 pages_failed;         /* base pages, a THP counts as all of its pages */
     __u32 mode;
     __u32 reason;
+    __u32 thp_ok;               /* THPs among pages_ok, 0 on kernels without the field */
+    __u32 thp_failed;
+    __u32 inflight;             /* migrations in progress at the end, this one included */
+};
+
+/* ------------- Automatic NUMA balancing, per thread group ------------- */
+struct numa_task {
+    char comm[16];
+    __u64 faults_local;         /* hinting faults on a page already local */
+    __u64 faults_remote;
+    __u64 pages_local;          /* base pages covered by those faults */
+    __u64 pages_remote;
+    __u64 fault_migrated;       /* pages the fault path migrated */
+    __u64 fault_migrate_failed;
+    __u64 mig_calls;            /* migrate_pages() for MR_NUMA_MISPLACED */
+    __u64 mig_pages_ok;
+    __u64 mig_pages_failed;
+    __u64 mig_ns;
+    __u64 task_moves;           /* sched_move_numa: moved to its preferred node */
+    __u64 task_swaps;           /* sched_swap_numa: swapped with another task */
+    __u64 task_sticks;          /* sched_stick_numa: could not be placed */
 };
 
 #endif /* __MIGRATE_LAT_H */
\ No newline at end of file
@@ -1,64 +1,350 @@
 // gcc -O2 -g -Wall migrate_lat_user.c -o migrate_lat_user \
 //       -I/usr/include/ -lbpf -lelf -lz
 #include <stdio.h>
+#include <stdlib.h>
 #include <signal.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <string.h>
-#include <sys/resource.h>
+#include <time.h>
 #include <bpf/libbpf.h>
+#include <bpf/bpf.h>
 #include "migrate_lat.h"
 #include "migrate_lat.skel.h"
 
 static volatile bool stop = false;
 static void handle_int(int sig) { stop = true; }
 
+/* ------------- enum migrate_reason, include/linux/migrate_mode.h ------------- */
+static const char *const reason_names[] = {
+        "compaction", "memory_failure", "memory_hotplug", "syscall_or_cpuset",
+        "mempolicy_mbind", "numa_misplaced", "contig_range", "longterm_pin",
+        "demotion", "damon",
+};
+#define NR_REASONS (sizeof(reason_names) / sizeof(reason_names[0]))
+#define FAIL_BUCKETS 16
+
+/* Totals per migrate_reason, printed on exit */
+struct reason_stats {
+        __u64 calls;
+        __u64 calls_failed;     /* calls with at least one failed page */
+        __u64 pages_ok;
+        __u64 pages_failed;
+        __u64 lat_ns;
+        __u64 lat_failed_ns;    /* latency of the calls that had failures */
+};
+
+static struct reason_stats stats[NR_REASONS + 1];       /* last slot: unknown reason */
+static __u64 fail_hist[FAIL_BUCKETS];                   /* log2(failed pages) per call */
+
+static void account_event(const struct lat_event *e)
+{
+        struct reason_stats *r = &stats[e->reason < NR_REASONS ? e->reason : NR_REASONS];
+
+        r->calls++;
+        r->pages_ok     += e->pages_ok;
+        r->pages_failed += e->pages_failed;
+        r->lat_ns       += e->delta_ns;
+        if (e->pages_failed) {
+                int b = 64 - __builtin_clzll(e->pages_failed);
+                r->calls_failed++;
+                r->lat_failed_ns += e->delta_ns;
+                fail_hist[b < FAIL_BUCKETS ? b : FAIL_BUCKETS - 1]++;
+        }
+}
+
+static void print_summary(void)
+{
+        __u64 calls = 0, calls_failed = 0, ok = 0, failed = 0;
+
+        printf("\n%-18s %8s %8s %10s %10s %7s %12s %12s\n", "REASON", "CALLS", "W/FAIL",
+               "OK", "FAIL", "FAIL%", "AVG(ms)", "AVG-FAIL(ms)");
+        for (size_t i = 0; i <= NR_REASONS; i++) {
+                const struct reason_stats *r = &stats[i];
+                __u64 pages = r->pages_ok + r->pages_failed;
+                if (!r->calls)
+                        continue;
+                printf("%-18s %8llu %8llu %10llu %10llu %6.1f%% %12.3f %12.3f\n",
+                       i < NR_REASONS ? reason_names[i] : "unknown",
+                       r->calls, r->calls_failed, r->pages_ok, r->pages_failed,
+                       pages ? 100.0 * r->pages_failed / pages : 0.0,
+                       r->lat_ns / 1e6 / r->calls,
+                       r->calls_failed ? r->lat_failed_ns / 1e6 / r->calls_failed : 0.0);
+                calls += r->calls;
+                calls_failed += r->calls_failed;
+                ok += r->pages_ok;
+                failed += r->pages_failed;
+        }
+        printf("total: %llu calls, %llu with failures, %llu/%llu pages failed\n",
+               calls, calls_failed, failed, ok + failed);
+
+        if (!calls_failed)
+                return;
+        printf("\nfailed pages per call:\n");
+        for (int b = 1; b < FAIL_BUCKETS; b++) {
+                if (!fail_hist[b])
+                        continue;
+                /* the last bucket takes every larger count too */
+                if (b == FAIL_BUCKETS - 1)
+                        printf("  [%6llu,    inf) %llu\n", 1ULL << (b - 1), fail_hist[b]);
+                else
+                        printf("  [%6llu, %6llu) %llu\n", 1ULL << (b - 1), 1ULL << b, fail_hist[b]);
+        }
+}
+
+/* ------------- Automatic NUMA balancing per task (-N) ------------- */
+struct numa_row {
+        __u32 tgid;
+        struct numa_task prev;          /* counters at the previous interval */
+        double first_local;             /* local fault share of the first interval */
+        double last_local;              /* ... and of the latest, < 0 until seen */
+};
+
+static struct numa_row *rows;
+static int nr_rows, cap_rows;
+
+static struct numa_row *numa_row(__u32 tgid)
+{
+        for (int i = 0; i < nr_rows; i++) {
+                if (rows[i].tgid == tgid)
+                        return &rows[i];
+        }
+        if (nr_rows == cap_rows) {
+                int cap = cap_rows ? 2 * cap_rows : 64;
+                struct numa_row *r = realloc(rows, cap * sizeof(*r));
+                if (!r)
+                        return NULL;
+                rows = r;
+                cap_rows = cap;
+        }
+        rows[nr_rows] = (struct numa_row){ .tgid = tgid, .first_local = -1, .last_local = -1 };
+        return &rows[nr_rows++];
+}
+
+/* Per-task activity since the previous call, one line per active task */
+static void print_numa_interval(int fd, double secs)
+{
+        __u32 key, next;
+        struct numa_task v;
+        int header = 1;
+
+        for (int err = bpf_map_get_next_key(fd, NULL, &next); !err;
+             err = bpf_map_get_next_key(fd, &key, &next)) {
+                struct numa_row *row;
+                __u64 local, remote, faults;
+
+                key = next;
+                if (bpf_map_lookup_elem(fd, &key, &v) || !(row = numa_row(key)))
+                        continue;
+                const struct numa_task *p = &row->prev;
+                local  = v.faults_local - p->faults_local;
+                remote = v.faults_remote - p->faults_remote;
+                faults = local + remote;
+                if (!faults && v.mig_calls == p->mig_calls && v.task_moves == p->task_moves &&
+                    v.task_swaps == p->task_swaps && v.task_sticks == p->task_sticks) {
+                        row->prev = v;
+                        continue;
+                }
+                if (faults) {
+                        row->last_local = 100.0 * local / faults;
+                        if (row->first_local < 0)
+                                row->first_local = row->last_local;
+                }
+                if (header) {
+                        printf("\n%8s %-7s %-16s %8s %7s %9s %7s %9s %6s %6s %6s\n", "TIME(s)",
+                               "TGID", "COMM", "FAULTS", "LOCAL%", "MIGRATED", "FAILED",
+                               "MIG(ms)", "MOVES", "SWAPS", "STICKS");
+                        header = 0;
+                }
+                printf("%8.1f %-7u %-16s %8llu %6.1f%% %9llu %7llu %9.3f %6llu %6llu %6llu\n",
+                       secs, key, v.comm[0] ? v.comm : "?", faults,
+                       faults ? 100.0 * local / faults : 0.0,
+                       v.fault_migrated - p->fault_migrated,
+                       v.fault_migrate_failed - p->fault_migrate_failed,
+                       (v.mig_ns - p->mig_ns) / 1e6,
+                       v.task_moves - p->task_moves, v.task_swaps - p->task_swaps,
+                       v.task_sticks - p->task_sticks);
+                row->prev = v;
+        }
+        fflush(stdout);
+}
+
+/* Whole-run totals: did the balancer's migrations buy locality? */
+static void print_numa_summary(void)
+{
+        if (!nr_rows)
+                return;
+        printf("\n%-7s %-16s %9s %7s %15s %9s %9s %9s %6s %6s %6s\n", "TGID", "COMM",
+               "FAULTS", "LOCAL%", "LOCAL% 1st->end", "MIGRATED", "MIG(ms)", "us/PAGE",
+               "MOVES", "SWAPS", "STICKS");
+        for (int i = 0; i < nr_rows; i++) {
+                const struct numa_task *t = &rows[i].prev;
+                __u64 faults = t->faults_local + t->faults_remote;
+                if (!faults && !t->mig_calls)
+                        continue;
+                printf("%-7u %-16s %9llu %6.1f%% %6.1f%%->%5.1f%% %9llu %9.3f %9.2f %6llu %6llu %6llu\n",
+                       rows[i].tgid, t->comm[0] ? t->comm : "?", faults,
+                       faults ? 100.0 * t->faults_local / faults : 0.0,
+                       rows[i].first_local < 0 ? 0.0 : rows[i].first_local,
+                       rows[i].last_local < 0 ? 0.0 : rows[i].last_local,
+                       t->fault_migrated, t->mig_ns / 1e6,
+                       t->mig_pages_ok ? t->mig_ns / 1e3 / t->mig_pages_ok : 0.0,
+                       t->task_moves, t->task_swaps, t->task_sticks);
+        }
+}
+
+/* Ring buffer sizes must be a power-of-two multiple of the page size */
+static __u32 ringbuf_bytes(unsigned long kb)
+{
+        unsigned long page = sysconf(_SC_PAGESIZE), sz = page;
+        while (sz < kb * 1024 && sz < (1UL << 30))
+                sz <<= 1;
+        return sz;
+}
+
+static double now_s(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ------------- Recording (-o), the input of cost_model fit ------------- */
+static FILE *record;
+
+static void record_event(const struct lat_event *e)
+{
+        struct timespec ts;
+        char comm[sizeof(e->comm) + 1];
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        /* comm may hold anything but a NUL: keep the CSV parseable */
+        for (size_t i = 0; i < sizeof(e->comm); i++)
+                comm[i] = e->comm[i] == ',' || e->comm[i] == '\n' ? '_' : e->comm[i];
+        comm[sizeof(e->comm)] = 0;
+        fprintf(record, "%llu,%u,%s,%u,%u,%llu,%llu,%u,%u,%u,%llu\n",
+                ts.tv_sec * 1000000000ULL + ts.tv_nsec, e->pid, comm, e->reason, e->mode,
+                e->pages_ok, e->pages_failed, e->thp_ok, e->thp_failed, e->inflight,
+                e->delta_ns);
+}
+
 static int handle_event(void *ctx, void *data, unsigned long size)
 {
         pid_t _pid = *((pid_t*)ctx);
         const struct lat_event *e = data;
+        if (record)
+                record_event(e);
         if (strncmp(e->comm,"migratepages",12) == 0) {
             printf("%-16s %-6u  %9.3f ms  ok=%-5llu  fail=%-5llu  mode=%u  reason=%u\n",
                    e->comm, e->pid, e->delta_ns / 1e6,
                    e->pages_ok, e->pages_failed, e->mode, e->reason);
+            account_event(e);
         }
         return 0;
 }
 
 int main(int argc, char** argv) {
         int pid = -1;
+        int numa = 0;
+        double interval = 1.0;
+        unsigned long ringbuf_kb = 256;         /* ~4600 events in flight */
+        __u32 max_starts = 1024;                /* concurrent migrations */
+        __u32 max_tasks = 1024;                 /* tasks tracked by -N */
+        const char *record_path = NULL;
         
         static struct option long_options[] = {
             {"pid",  required_argument, 0, 'p'},
+            {"numa", no_argument,       0, 'N'},
+            {"interval", required_argument, 0, 'i'},
+            {"ringbuf-kb", required_argument, 0, 'b'},
+            {"starts", required_argument, 0, 's'},
+            {"tasks", required_argument, 0, 't'},
+            {"output", required_argument, 0, 'o'},
             {0, 0, 0, 0}
         };
 
         int opt;
 
-        while ((opt = getopt_long(argc, argv, "p:", long_options, NULL)) != -1) {
+        while ((opt = getopt_long(argc, argv, "p:Ni:b:s:t:o:", long_options, NULL)) != -1) {
             switch (opt) {
                 case 'p':
                     pid = atoi(optarg);
                     break;
+                case 'N':
+                    numa = 1;
+                    break;
+                case 'i':
+                    interval = atof(optarg);
+                    break;
+                case 'b':
+                    ringbuf_kb = strtoul(optarg, NULL, 0);
+                    break;
+                case 's':
+                    max_starts = strtoul(optarg, NULL, 0);
+                    break;
+                case 't':
+                    max_tasks = strtoul(optarg, NULL, 0);
+                    break;
+                case 'o':
+                    record_path = optarg;
+                    break;
                 default:
-                    fprintf(stderr, "Usage: %s -p <pid>\n", argv[0]);
+                    fprintf(stderr, "Usage: %s -p <pid> | -o <file.csv> | -N [-p <pid>] [-i <secs>]\n"
+                            "          [-b ringbuf-kb (256)] [-s starts (1024)] [-t tasks (1024)]\n"
+                            "  -o  record every migration of every task, for cost_model fit\n",
+                            argv[0]);
                     exit(EXIT_FAILURE);
             }
         }
 
-        if (pid == -1) {
+        if (pid == -1 && !numa && !record_path) {
             fprintf(stderr, "PID is required\n");
             exit(EXIT_FAILURE);
         }
+        if (record_path && numa) {
+            fprintf(stderr, "-o records per-call events, which -N does not collect\n");
+            exit(EXIT_FAILURE);
+        }
+        if (interval <= 0 || !max_starts || !max_tasks) {
+            fprintf(stderr, "interval and map sizes must be positive\n");
+            exit(EXIT_FAILURE);
+        }
 
-        struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
-        setrlimit(RLIMIT_MEMLOCK, &r);
+        if (record_path) {
+            record = fopen(record_path, "w");
+            if (!record) {
+                perror(record_path);
+                return 1;
+            }
+            fprintf(record, "# migrate_lat v1\n"
+                    "ts_ns,pid,comm,reason,mode,pages_ok,pages_failed,thp_ok,thp_failed,inflight,lat_ns\n");
+        }
 
+        // No RLIMIT_MEMLOCK bump: libbpf raises it only on kernels that
+        // still charge BPF memory to memlock rather than to the memcg.
         struct migrate_lat_bpf *skel = migrate_lat_bpf__open();
         if (!skel) { perror("open"); return 1; }
 
+        // Size the maps for the mode and load only the programs it uses
+        bpf_map__set_max_entries(skel->maps.starts, max_starts);
+        if (numa) {
+            skel->rodata->numa_tgid   = pid > 0 ? pid : 0;
+            skel->rodata->numa_stats  = true;
+            skel->rodata->emit_events = false;
+            bpf_map__set_max_entries(skel->maps.numa_tasks, max_tasks);
+            bpf_map__set_max_entries(skel->maps.events, ringbuf_bytes(0));
+            bpf_program__set_autoload(skel->progs.handle_task_numa_fault, true);
+            bpf_program__set_autoload(skel->progs.handle_sched_move_numa, true);
+            bpf_program__set_autoload(skel->progs.handle_sched_swap_numa, true);
+            bpf_program__set_autoload(skel->progs.handle_sched_stick_numa, true);
+        } else {
+            bpf_map__set_max_entries(skel->maps.numa_tasks, 1);
+            bpf_map__set_max_entries(skel->maps.events, ringbuf_bytes(ringbuf_kb));
+        }
+
         if (migrate_lat_bpf__load(skel) || migrate_lat_bpf__attach(skel)) {
             fprintf(stderr, "load/attach failed\n");
+            migrate_lat_bpf__destroy(skel);
             return 1;
         }
 
@@ -72,13 +358,29 @@ int main(int argc, char** argv) {
 
         signal(SIGINT, handle_int);
         signal(SIGTERM, handle_int);
-        printf("%-16s %-6s %-11s %-9s %-9s %-6s %-6s\n",
-               "COMM", "PID", "LAT(ms)", "OK", "FAIL", "MODE", "RSN");
+        if (!numa)
+            printf("%-16s %-6s %-11s %-9s %-9s %-6s %-6s\n",
+                   "COMM", "PID", "LAT(ms)", "OK", "FAIL", "MODE", "RSN");
+        fflush(stdout);         // attached: bench.sh waits for the header
 
+        double start = now_s(), next = start + interval;
         while (!stop) {
             ring_buffer__poll(rb, 100);
+            if (numa && now_s() >= next) {
+                print_numa_interval(bpf_map__fd(skel->maps.numa_tasks), now_s() - start);
+                next += interval;
+            }
         }
         
+        if (numa) {
+            print_numa_interval(bpf_map__fd(skel->maps.numa_tasks), now_s() - start);
+            print_numa_summary();
+            free(rows);
+        } else {
+            print_summary();
+        }
+        if (record)
+            fclose(record);
         ring_buffer__free(rb);
         migrate_lat_bpf__destroy(skel);
         return 0;
@@ -0,0 +1,185 @@
+#!/bin/sh
+# Migration regression suite, run by `make bench`.
+#
+# Runs a fixed matrix of page_migrations configurations (page count, engine,
+# page size, threads) REPS times each, then the collector overhead
+# microbenchmarks, writes bench/results-<kernel>.json and compares it with
+# the stored baseline.  Exits 2 when a series regressed or a baseline
+# series was not run, 1 when a run failed.
+#
+# On a single node the pages "move" from node 0 to node 0, which measures
+# the syscall and page-walk path but no copy; boot with numa=fake=2 to get
+# two nodes, and a copy, on a single socket.  Compare baselines taken on
+# the same topology only.
+#
+# Environment:
+#   REPS        repetitions per configuration (default 5)
+#   SRC DST     nodes to move between (default 0 and 1, or 0 and 0)
+#   CPU         first CPU to pin to (default 0)
+#   QUICK       1: a reduced matrix for a smoke test
+#   COLLECTORS  directory with migrate_lat_user and hotpages_user, '' to skip
+#   BASELINE    baseline to compare with (default bench/baseline.json)
+#   THRESHOLD   smallest regression that counts, in % (default 10)
+#   SIGMAS      ... and in robust standard deviations (default 3)
+#   EVENT_SECS  duration of each microbenchmark run (default 3)
+set -u
+cd "$(dirname "$0")" || exit 1
+
+REPS=${REPS:-5}
+CPU=${CPU:-0}
+QUICK=${QUICK:-0}
+COLLECTORS=${COLLECTORS-..}
+BASELINE=${BASELINE:-bench/baseline.json}
+THRESHOLD=${THRESHOLD:-10}
+SIGMAS=${SIGMAS:-3}
+EVENT_SECS=${EVENT_SECS:-3}
+
+NODES=$(ls -d /sys/devices/system/node/node[0-9]* 2>/dev/null | wc -l)
+SRC=${SRC:-0}
+if [ "$NODES" -ge 2 ]; then DST=${DST:-1}; else DST=${DST:-0}; fi
+
+if [ "$QUICK" = 1 ]; then
+    PAGES_4K="64 1024"; PAGES_2M="1"; THREADS="1 2"
+else
+    PAGES_4K="64 1024 16384"; PAGES_2M="1 8 32"; THREADS="1 4"
+fi
+ENGINES="move_pages mbind migrate_pages"
+
+KERNEL=$(uname -r)
+mkdir -p bench
+MATRIX=bench/matrix-$KERNEL.csv
+EVENTS=bench/events-$KERNEL.csv
+RESULTS=bench/results-$KERNEL.json
+rm -f "$MATRIX" "$EVENTS"
+
+echo "== $NODES node(s), moving node $SRC -> $DST, $REPS repetitions, kernel $KERNEL"
+[ "$SRC" = "$DST" ] && echo "   same-node run: no copy is measured (numa=fake=2 gives two nodes)"
+
+# ---------- migration matrix ----------
+failed=0
+run() {
+    # $1 engine, $2 threads, $3 pages, $4 extra flags
+    if ! ./page_migrations -e none -y -q -m "$1" -T "$2" $4 -o "$MATRIX" \
+            "$3" "$SRC" "$DST" "$CPU" > /dev/null 2>&1; then
+        failed=$((failed + 1))
+        echo "   failed: -m $1 -T $2 $4 $3" >&2
+    fi
+}
+
+for engine in $ENGINES; do
+    for threads in $THREADS; do
+        # migrate_pages(2) moves the whole process in one call
+        [ "$engine" = migrate_pages ] && [ "$threads" != 1 ] && continue
+        for size in 4k 2m; do
+            if [ $size = 4k ]; then pages=$PAGES_4K; flags=""; else pages=$PAGES_2M; flags="-H"; fi
+            for n in $pages; do
+                # page_migrations caps threads at pages: the run would land in another series
+                [ "$threads" -gt "$n" ] && continue
+                printf '   %-14s %-3s %6s pages, %s threads\n' "$engine" "$size" "$n" "$threads"
+                i=0
+                while [ $i -lt "$REPS" ]; do
+                    run "$engine" "$threads" "$n" "$flags"
+                    i=$((i + 1))
+                done
+            done
+        done
+    done
+done
+
+# ---------- collector overhead ----------
+event() {
+    # $1 bench, $2 label, extra args to event_bench
+    b=$1; l=$2; shift 2
+    if ! ./event_bench -b "$b" -l "$l" -d "$EVENT_SECS" -s "$SRC" -t "$DST" -o "$EVENTS" "$@"; then
+        failed=$((failed + 1))
+        echo "   failed: event_bench -b $b ($l)" >&2
+    fi
+}
+
+have_collector() {
+    [ -n "$COLLECTORS" ] && [ -x "$COLLECTORS/$1" ] && [ "$(id -u)" = 0 ]
+}
+
+# Collectors print a header once loaded and attached: wait until the file
+# their stdout goes to ($2) is not empty, while the collector ($1) lives
+ready=$(mktemp) || exit 1
+trap 'rm -f "$ready"' EXIT
+wait_ready() {
+    t=0
+    until [ -s "$2" ]; do
+        kill -0 "$1" 2>/dev/null || return 1
+        [ $t -ge 300 ] && return 1         # 30 s
+        sleep 0.1
+        t=$((t + 1))
+    done
+}
+
+collector_failed() {
+    failed=$((failed + 1))
+    echo "   failed: $1 did not attach" >&2
+}
+
+echo "== collector overhead"
+# move_pages to the node a page is on migrates nothing: the mm_migrate_pages
+# tracepoints never fire and migrate_lat would cost ~0% by construction
+lat_bench=1
+if [ "$SRC" = "$DST" ]; then
+    lat_bench=0
+    echo "   migrate_lat not measured: same-node run, its tracepoints do not fire"
+fi
+i=0
+while [ $i -lt "$REPS" ]; do
+    event migrate none
+    event fault none
+
+    if [ $lat_bench = 1 ] && have_collector migrate_lat_user; then
+        : > "$ready"
+        "$COLLECTORS/migrate_lat_user" -o /dev/null > "$ready" 2>/dev/null &
+        col=$!
+        if wait_ready $col "$ready"; then
+            event migrate migrate_lat
+        else
+            collector_failed migrate_lat_user
+        fi
+        kill -INT $col 2>/dev/null; wait $col
+    fi
+    if have_collector hotpages_user; then
+        # hotpages needs the pid before the bench starts: the subshell that
+        # execs into event_bench holds until the collector has attached to it
+        : > "$ready"
+        (until [ -s "$ready" ]; do sleep 0.1; done
+         exec ./event_bench -b fault -l hotpages -d "$EVENT_SECS" -o "$EVENTS") &
+        target=$!
+        "$COLLECTORS/hotpages_user" -p $target -i 1 > "$ready" 2>/dev/null &
+        col=$!
+        if wait_ready $col "$ready"; then
+            if ! wait $target; then
+                failed=$((failed + 1))
+                echo "   failed: event_bench -b fault (hotpages)" >&2
+            fi
+        else
+            kill $target; wait $target
+            collector_failed hotpages_user
+        fi
+        kill -INT $col 2>/dev/null; wait $col
+    fi
+    i=$((i + 1))
+done
+have_collector migrate_lat_user && have_collector hotpages_user ||
+    echo "   collectors not measured: need root and built migrate_lat_user/hotpages_user in '$COLLECTORS'"
+
+# ---------- report ----------
+echo "== results in $RESULTS"
+status=0
+if [ -f "$BASELINE" ]; then
+    ./bench_report -m "$MATRIX" -e "$EVENTS" -o "$RESULTS" -b "$BASELINE" -t "$THRESHOLD" -k "$SIGMAS" ||
+        status=$?
+else
+    ./bench_report -m "$MATRIX" -e "$EVENTS" -o "$RESULTS" || status=$?
+    [ $status = 0 ] && echo "   no baseline at $BASELINE: 'make bench-baseline' stores this run as one"
+fi
+if [ $failed -gt 0 ]; then
+    echo "== $failed runs failed"
+    [ $status = 0 ] && status=1
+fi
+exit $status
@@ -0,0 +1,394 @@
+// Summarise a bench run as JSON and compare it with a stored baseline.
+//
+// Inputs are the CSVs page_migrations -o and event_bench -o append to, one
+// row per repetition.  Rows of the same configuration form a series,
+// reported as median and MAD (median absolute deviation) with the raw
+// samples.  Against a baseline a series regresses when its median is worse
+// by more than -t percent *and* by more than -k robust standard deviations
+// (1.4826 * MAD, the larger of the two runs'), so that a noisy
+// configuration needs a larger change before it fails the run.  Runs that
+// left pages unmoved, and baseline series this run did not produce, fail
+// it too: a hole in the matrix must not pass as "no regression".
+//
+// The JSON puts one result per line; the baseline reader relies on that.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#define MAX_SERIES 256
+#define NAME_LEN 96
+#define MAD_TO_SD 1.4826            // MAD of a normal distribution -> its sd
+
+struct series {
+    char name[NAME_LEN];
+    const char *metric;
+    int lower_better;
+    double *v;
+    int n, cap;
+    double median, mad, mean, min, max;
+    double overhead;                // event series: throughput lost to the collector, %
+};
+
+struct baseline {
+    char name[NAME_LEN];
+    double median, mad;
+    int n;
+    int seen;
+};
+
+static struct series series[MAX_SERIES];
+static int nr_series;
+
+static struct series *get_series(const char *name, const char *metric, int lower_better) {
+    for (int i = 0; i < nr_series; i++) {
+        if (!strcmp(series[i].name, name))
+            return &series[i];
+    }
+    if (nr_series == MAX_SERIES)
+        return NULL;
+    struct series *s = &series[nr_series++];
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    s->metric = metric;
+    s->lower_better = lower_better;
+    return s;
+}
+
+static int add_sample(struct series *s, double v) {
+    if (s->n == s->cap) {
+        int cap = s->cap ? 2 * s->cap : 8;
+        double *nv = realloc(s->v, cap * sizeof(*nv));
+        if (!nv)
+            return -ENOMEM;
+        s->v = nv;
+        s->cap = cap;
+    }
+    s->v[s->n++] = v;
+    return 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double median_of(double *v, int n) {
+    qsort(v, n, sizeof(*v), cmp_double);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static int summarise(struct series *s) {
+    double *dev = malloc(s->n * sizeof(*dev));
+    if (!dev)
+        return -ENOMEM;
+    s->mean = 0;
+    for (int i = 0; i < s->n; i++)
+        s->mean += s->v[i] / s->n;
+    s->median = median_of(s->v, s->n);     // sorts v
+    s->min = s->v[0];
+    s->max = s->v[s->n - 1];
+    for (int i = 0; i < s->n; i++)
+        dev[i] = fabs(s->v[i] - s->median);
+    s->mad = median_of(dev, s->n);
+    free(dev);
+    return 0;
+}
+
+/* Split @line in place on commas; returns the number of fields */
+static int split_csv(char *line, char **fields, int max) {
+    int n = 0;
+    line[strcspn(line, "\r\n")] = 0;
+    while (n < max) {
+        fields[n++] = line;
+        line = strchr(line, ',');
+        if (!line)
+            break;
+        *line++ = 0;
+    }
+    return n;
+}
+
+/*
+ * page_migrations -o rows:
+ * pages,page_size,batch,calls,moved,failed,move_ns,total_ns,engine,threads
+ * One series per engine, page size, page count and thread count, in wall
+ * ns per page.  migrate_pages moves every page of the process, an unknown
+ * number, so its series is in wall ns per call instead.  Runs where pages
+ * failed to move are skipped and counted as failures.
+ */
+static int load_matrix(const char *path, int *failed_runs) {
+    FILE *f = fopen(path, "r");
+    char line[512], *fld[16], name[NAME_LEN];
+
+    if (!f)
+        return -errno;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || !strncmp(line, "pages,", 6))
+            continue;
+        if (split_csv(line, fld, 16) < 10)
+            continue;
+        unsigned long pages = strtoul(fld[0], NULL, 0);
+        if (!pages)
+            continue;
+        if (strtoul(fld[5], NULL, 0)) {
+            (*failed_runs)++;
+            continue;
+        }
+        snprintf(name, sizeof(name), "migrate/%s/%luk/%lu/%st", fld[8],
+                 strtoul(fld[1], NULL, 0) / 1024, pages, fld[9]);
+        int whole = !strcmp(fld[8], "migrate_pages");
+        unsigned long per = whole ? strtoul(fld[3], NULL, 0) : pages;
+        if (!per)
+            continue;
+        struct series *s = get_series(name, whole ? "ns_per_call" : "ns_per_page", 1);
+        if (!s || add_sample(s, strtod(fld[7], NULL) / per)) {
+            fclose(f);
+            return -ENOMEM;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/* event_bench -o rows: bench,collector,events,ns, in events/s */
+static int load_events(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[256], *fld[8], name[NAME_LEN];
+
+    if (!f)
+        return -errno;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || !strncmp(line, "bench,", 6))
+            continue;
+        if (split_csv(line, fld, 8) < 4)
+            continue;
+        double ns = strtod(fld[3], NULL);
+        if (ns <= 0)
+            continue;
+        snprintf(name, sizeof(name), "events/%s/%s", fld[0], fld[1]);
+        struct series *s = get_series(name, "events_per_s", 0);
+        if (!s || add_sample(s, strtod(fld[2], NULL) / (ns / 1e9))) {
+            fclose(f);
+            return -ENOMEM;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+// Throughput each collector costs, against the same bench with none
+static void event_overheads(void) {
+    char name[NAME_LEN];
+    for (int i = 0; i < nr_series; i++) {
+        struct series *s = &series[i];
+        const char *slash = strrchr(s->name, '/');
+        if (strncmp(s->name, "events/", 7) || !strcmp(slash + 1, "none"))
+            continue;
+        snprintf(name, sizeof(name), "%.*s/none", (int)(slash - s->name), s->name);
+        for (int j = 0; j < nr_series; j++) {
+            if (!strcmp(series[j].name, name) && series[j].median > 0)
+                s->overhead = 100 * (1 - s->median / series[j].median);
+        }
+    }
+}
+
+static void write_json(FILE *out) {
+    struct utsname u;
+    uname(&u);
+    fprintf(out, "{\n  \"schema\": \"migrate-bench v1\",\n");
+    fprintf(out, "  \"kernel\": \"%s\",\n  \"machine\": \"%s\",\n  \"host\": \"%s\",\n",
+            u.release, u.machine, u.nodename);
+    fprintf(out, "  \"results\": [\n");
+    for (int i = 0; i < nr_series; i++) {
+        const struct series *s = &series[i];
+        fprintf(out, "    {\"name\": \"%s\", \"metric\": \"%s\", \"better\": \"%s\", \"n\": %d, "
+                "\"median\": %.6g, \"mad\": %.6g, \"mean\": %.6g, \"min\": %.6g, \"max\": %.6g",
+                s->name, s->metric, s->lower_better ? "lower" : "higher", s->n,
+                s->median, s->mad, s->mean, s->min, s->max);
+        if (!strncmp(s->name, "events/", 7) && !strstr(s->name, "/none"))
+            fprintf(out, ", \"overhead_pct\": %.2f", s->overhead);
+        fprintf(out, ", \"samples\": [");
+        for (int k = 0; k < s->n; k++)
+            fprintf(out, "%s%.6g", k ? ", " : "", s->v[k]);
+        fprintf(out, "]}%s\n", i + 1 < nr_series ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static int json_number(const char *line, const char *key, double *v) {
+    const char *p = strstr(line, key);
+    if (!p)
+        return -ENOENT;
+    *v = strtod(p + strlen(key), NULL);
+    return 0;
+}
+
+static int load_baseline(const char *path, struct baseline **out, int *nr) {
+    FILE *f = fopen(path, "r");
+    char line[8192];
+    struct baseline *b = NULL;
+    int n = 0, cap = 0;
+
+    if (!f)
+        return -errno;
+    while (fgets(line, sizeof(line), f)) {
+        const char *p = strstr(line, "\"name\": \"");
+        double median, mad, cnt;
+        if (!p || json_number(line, "\"median\": ", &median) ||
+            json_number(line, "\"mad\": ", &mad) || json_number(line, "\"n\": ", &cnt))
+            continue;
+        if (n == cap) {
+            cap = cap ? 2 * cap : 64;
+            struct baseline *nb = realloc(b, cap * sizeof(*nb));
+            if (!nb) {
+                free(b);
+                fclose(f);
+                return -ENOMEM;
+            }
+            b = nb;
+        }
+        p += strlen("\"name\": \"");
+        snprintf(b[n].name, sizeof(b[n].name), "%.*s", (int)strcspn(p, "\""), p);
+        b[n].median = median;
+        b[n].mad = mad;
+        b[n].n = cnt;
+        b[n].seen = 0;
+        n++;
+    }
+    fclose(f);
+    *out = b;
+    *nr = n;
+    return 0;
+}
+
+/* Print a verdict per series to @out; returns the number of regressions,
+ * and in @missing the number of baseline series without samples now */
+static int compare(FILE *out, struct baseline *b, int nr, double rel, double sigmas, int *missing) {
+    int regressions = 0;
+
+    *missing = 0;
+    fprintf(out, "%-36s %12s %12s %8s %8s  %s\n", "SERIES", "BASELINE", "NOW", "CHANGE", "NOISE", "VERDICT");
+    for (int i = 0; i < nr_series; i++) {
+        const struct series *s = &series[i];
+        struct baseline *base = NULL;
+        for (int j = 0; j < nr && !base; j++) {
+            if (!strcmp(b[j].name, s->name))
+                base = &b[j];
+        }
+        if (!base || base->median <= 0) {
+            fprintf(out, "%-36s %12s %12.4g %8s %8s  new\n", s->name, "-", s->median, "-", "-");
+            continue;
+        }
+        base->seen = 1;
+        // positive: worse than the baseline
+        double worse = s->lower_better ? s->median - base->median : base->median - s->median;
+        double noise = MAD_TO_SD * fmax(s->mad, base->mad);
+        const char *verdict = "ok";
+        if (fabs(worse) > rel * base->median && fabs(worse) > sigmas * noise) {
+            verdict = worse > 0 ? "REGRESSION" : "improved";
+            regressions += worse > 0;
+        }
+        fprintf(out, "%-36s %12.4g %12.4g %+7.1f%% %7.1f%%  %s%s\n", s->name, base->median, s->median,
+                100 * (s->median - base->median) / base->median, 100 * noise / base->median, verdict,
+                s->n < 3 || base->n < 3 ? " (fewer than 3 samples)" : "");
+    }
+    for (int j = 0; j < nr; j++) {
+        if (!b[j].seen) {
+            fprintf(out, "%-36s %12.4g %12s %8s %8s  NOT RUN\n", b[j].name, b[j].median, "-", "-", "-");
+            (*missing)++;
+        }
+    }
+    return regressions;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-m matrix.csv]... [-e events.csv]... [-o results.json]\n"
+            "          [-b baseline.json] [-t percent] [-k sigmas]\n"
+            "  -m  rows appended by page_migrations -o\n"
+            "  -e  rows appended by event_bench -o\n"
+            "  -o  where to write the JSON (default: stdout)\n"
+            "  -b  baseline to compare with; exit 2 on a regression\n"
+            "      or a baseline series not run (or -m runs that failed)\n"
+            "  -t  smallest change that counts, in %% of the baseline (default: 10)\n"
+            "  -k  ... and in robust standard deviations (default: 3)\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = NULL, *baseline_path = NULL;
+    double rel = 0.10, sigmas = 3;
+    int opt, err = 0, failed_runs = 0, ret;
+
+    while ((opt = getopt(argc, argv, "m:e:o:b:t:k:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            err = load_matrix(optarg, &failed_runs);
+            break;
+        case 'e':
+            err = load_events(optarg);
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'b':
+            baseline_path = optarg;
+            break;
+        case 't':
+            rel = atof(optarg) / 100;
+            break;
+        case 'k':
+            sigmas = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+        if (err) {
+            fprintf(stderr, "%s: %s\n", optarg, strerror(-err));
+            return 1;
+        }
+    }
+    if (!nr_series) {
+        fprintf(stderr, "no results\n");
+        usage(argv[0]);
+        return 1;
+    }
+    for (int i = 0; i < nr_series; i++) {
+        if (summarise(&series[i]))
+            return 1;
+    }
+    event_overheads();
+    if (failed_runs)
+        fprintf(stderr, "%d runs left pages unmoved and were not counted\n", failed_runs);
+    ret = failed_runs ? 2 : 0;
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        perror(out_path);
+        return 1;
+    }
+    write_json(out);
+    if (out_path)
+        fclose(out);
+
+    if (baseline_path) {
+        struct baseline *b;
+        int nr;
+        if ((err = load_baseline(baseline_path, &b, &nr))) {
+            fprintf(stderr, "%s: %s\n", baseline_path, strerror(-err));
+            return 1;
+        }
+        int missing, regressions = compare(stderr, b, nr, rel, sigmas, &missing);
+        free(b);
+        if (regressions)
+            fprintf(stderr, "%d regressions against %s\n", regressions, baseline_path);
+        if (missing)
+            fprintf(stderr, "%d series of %s not run\n", missing, baseline_path);
+        if (regressions || missing)
+            ret = 2;
+    }
+    return ret;
+}
@@ -1,2 +1,3 @@
-gcc -g -O0 page_migrations.c perf_events.c -o page_migrations.o -lnuma
+gcc -g -O0 page_migrations.c perf_events.c perf_resolve.c perf_sample.c migrate_engine.c -o page_migrations.o -lnuma -lpthread
 
+gcc -g -O0 pace_migrate.c migrate_engine.c proc_maps.c -o pace_migrate -lnuma
@@ -0,0 +1,171 @@
+// Collector overhead microbenchmark: how many events per second the
+// kernel paths the BPF collectors hook can take, run once without and
+// once with a collector attached.
+//
+//   migrate  move_pages(2) of one page back and forth between two nodes,
+//            the mm_migrate_pages tracepoints migrate_lat uses
+//   fault    first-touch faults on fresh anonymous memory, the
+//            handle_mm_fault kprobe hotpages and tierd use
+//
+// With one node both directions are the same node: move_pages returns
+// early, only the syscall path is measured and the mm_migrate_pages
+// tracepoints never fire, so bench.sh does not run migrate_lat on it.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <numa.h>
+#include <numaif.h>
+
+#define PAGE_SIZE 4096
+#define FAULT_CHUNK (64UL << 20)    // mapped, touched and unmapped per round
+#define CLOCK_EVERY 64              // events between clock reads
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Ping-pong one page between @src and @dst until @ns have passed
+static int bench_migrate(int src, int dst, uint64_t ns, uint64_t *ops) {
+    char *page = numa_alloc_onnode(PAGE_SIZE, src);
+    int nodes[2] = { dst, src };
+    void *addr = page;
+    uint64_t t0;
+
+    if (!page)
+        return -ENOMEM;
+    page[0] = 1;
+    *ops = 0;
+    t0 = now_ns();
+    do {
+        for (int i = 0; i < CLOCK_EVERY; i++) {
+            int status;
+            if (move_pages(0, 1, &addr, &nodes[*ops & 1], &status, MPOL_MF_MOVE) < 0) {
+                int err = -errno;
+                numa_free(page, PAGE_SIZE);
+                return err;
+            }
+            (*ops)++;
+        }
+    } while (now_ns() - t0 < ns);
+    numa_free(page, PAGE_SIZE);
+    return 0;
+}
+
+// Fault in fresh anonymous pages, one write per page, until @ns have passed
+static int bench_fault(uint64_t ns, uint64_t *ops) {
+    uint64_t t0 = now_ns();
+
+    *ops = 0;
+    do {
+        char *mem = mmap(NULL, FAULT_CHUNK, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return -errno;
+        // no THP: one fault per base page
+        madvise(mem, FAULT_CHUNK, MADV_NOHUGEPAGE);
+        for (size_t off = 0; off < FAULT_CHUNK; off += PAGE_SIZE)
+            mem[off] = 1;
+        *ops += FAULT_CHUNK / PAGE_SIZE;
+        munmap(mem, FAULT_CHUNK);
+    } while (now_ns() - t0 < ns);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s -b migrate|fault [-d secs] [-w secs] [-s src] [-t dst]\n"
+            "          [-l label] [-o results.csv]\n"
+            "  -b  kernel path to exercise\n"
+            "  -d  how long to run (default: 3)\n"
+            "  -w  wait before starting, to attach a collector to this pid (default: 0)\n"
+            "  -s  node the page starts on (default: 0)\n"
+            "  -t  node it moves to (default: 1, or 0 on a single node)\n"
+            "  -l  collector attached, recorded with the result (default: none)\n"
+            "  -o  append the result to a CSV\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *bench = NULL, *label = "none", *csv = NULL;
+    double secs = 3, wait_s = 0;
+    int src = 0, dst = -1, opt, err;
+    uint64_t ops = 0, t0, ns;
+
+    while ((opt = getopt(argc, argv, "b:d:w:s:t:l:o:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            bench = optarg;
+            break;
+        case 'd':
+            secs = atof(optarg);
+            break;
+        case 'w':
+            wait_s = atof(optarg);
+            break;
+        case 's':
+            src = atoi(optarg);
+            break;
+        case 't':
+            dst = atoi(optarg);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 'o':
+            csv = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (!bench || secs <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (numa_available() < 0) {
+        fprintf(stderr, "NUMA not available\n");
+        return 1;
+    }
+    if (dst < 0)
+        dst = numa_max_node() > 0 ? 1 : 0;
+    if (wait_s > 0)
+        usleep(wait_s * 1e6);
+
+    t0 = now_ns();
+    if (!strcmp(bench, "migrate")) {
+        err = bench_migrate(src, dst, secs * 1e9, &ops);
+    } else if (!strcmp(bench, "fault")) {
+        err = bench_fault(secs * 1e9, &ops);
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+    ns = now_ns() - t0;
+    if (err) {
+        fprintf(stderr, "%s: %s\n", bench, strerror(-err));
+        return 1;
+    }
+
+    printf("%s (%s): %lu events in %.3f s, %.0f events/s\n", bench, label,
+           (unsigned long)ops, ns / 1e9, ops / (ns / 1e9));
+    if (csv) {
+        FILE *f = fopen(csv, "a");
+        if (!f) {
+            perror(csv);
+            return 1;
+        }
+        if (ftell(f) == 0)
+            fprintf(f, "# event_bench v1\nbench,collector,events,ns\n");
+        fprintf(f, "%s,%s,%lu,%lu\n", bench, label, (unsigned long)ops, (unsigned long)ns);
+        fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,248 @@
+#include "migrate_engine.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_us(unsigned us){
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000L };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+/* Which histogram bin a move_pages status belongs to */
+int migrate_status_bin(int status, int target){
+    if (status >= 0)
+        return status == target ? MIGRATE_BIN_MOVED : MIGRATE_BIN_WRONG;
+    if (-status < MIGRATE_MAX_ERRNO)
+        return MIGRATE_BIN_ERRNO(-status);
+    return MIGRATE_BIN_ERRNO(0);  // out of range, folded into "errno 0"
+}
+
+const char *migrate_bin_name(int bin, char *buf, size_t len){
+    switch (bin) {
+    case MIGRATE_BIN_MOVED:            return "moved";
+    case MIGRATE_BIN_WRONG:            return "wrong-node";
+    case MIGRATE_BIN_ERRNO(EBUSY):     return "EBUSY";
+    case MIGRATE_BIN_ERRNO(EAGAIN):    return "EAGAIN";
+    case MIGRATE_BIN_ERRNO(ENOMEM):    return "ENOMEM";
+    case MIGRATE_BIN_ERRNO(EACCES):    return "EACCES";
+    case MIGRATE_BIN_ERRNO(EFAULT):    return "EFAULT";
+    case MIGRATE_BIN_ERRNO(ENOENT):    return "ENOENT";
+    case MIGRATE_BIN_ERRNO(EIO):       return "EIO";
+    case MIGRATE_BIN_ERRNO(EINVAL):    return "EINVAL";
+    case MIGRATE_BIN_ERRNO(E2BIG):     return "E2BIG";
+    case MIGRATE_BIN_ERRNO(ENODEV):    return "ENODEV";
+    case MIGRATE_BIN_ERRNO(EHWPOISON): return "EHWPOISON";
+    }
+    snprintf(buf, len, "errno %d", bin - MIGRATE_BIN_ERRNO(0));
+    return buf;
+}
+
+static int is_transient(int status, int target){
+    return (status >= 0 && status != target) ||
+           status == -EBUSY || status == -EAGAIN || status == -ENOMEM;
+}
+
+static void settle(struct migrate_result *res, int round, uint64_t ns){
+    uint64_t us = ns / 1000;
+    int bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if (bucket >= MIGRATE_SETTLE_BUCKETS)
+        bucket = MIGRATE_SETTLE_BUCKETS - 1;
+    res->settled_round[round]++;
+    res->settle_us[bucket]++;
+    if (ns > res->max_settle_ns)
+        res->max_settle_ns = ns;
+}
+
+/*
+ * One pass over @count pages in chunks of policy->batch. A call that fails
+ * as a whole with ENOMEM/EAGAIN marks its chunk with that error so the pages
+ * are retried; any other call-level error aborts with -errno.
+ */
+static int move_pass(pid_t pid, unsigned long count, void **pages, const int *nodes, int *status,
+                     const struct migrate_policy *policy, struct migrate_result *res){
+    unsigned long batch = policy->batch ? policy->batch : count;
+
+    for (unsigned long off = 0; off < count; off += batch) {
+        unsigned long n = count - off < batch ? count - off : batch;
+        res->calls++;
+        if (move_pages(pid, n, pages + off, nodes + off, status + off, policy->flags) < 0) {
+            int err = errno;
+            if (err != ENOMEM && err != EAGAIN)
+                return -err;
+            for (unsigned long i = off; i < off + n; i++)
+                status[i] = -err;
+        }
+    }
+    return 0;
+}
+
+/**
+ * migrate_pages_retry - Move @count pages of @pid to @nodes, retrying
+ * transient failures.
+ * @status: final per-page status, as move_pages(2) reports it
+ *
+ * Retry rounds only pass the pages that are still pending, copied into
+ * compact arrays, and sleep policy->backoff_us doubled each round up to
+ * policy->max_backoff_us. Returns 0 once every page is moved or has a final
+ * error (see res->failed), or -errno if move_pages itself failed.
+ */
+int migrate_pages_retry(pid_t pid, unsigned long count, void **pages, const int *nodes, int *status,
+                        const struct migrate_policy *policy, struct migrate_result *res){
+    int max_retries = policy->max_retries < MIGRATE_MAX_ROUNDS ? policy->max_retries : MIGRATE_MAX_ROUNDS;
+    unsigned long *idx = NULL;
+    void **batch_pages = NULL;
+    int *batch_nodes = NULL;
+    int *batch_status = NULL;
+    unsigned long pending = 0;
+    int err;
+
+    memset(res, 0, sizeof(*res));
+    res->pages = count;
+    if (count == 0)
+        return 0;
+
+    uint64_t t0 = now_ns();
+    err = move_pass(pid, count, pages, nodes, status, policy, res);
+    if (err)
+        goto out;
+    res->first_pass_ns = now_ns() - t0;
+
+    idx = malloc(count * sizeof(*idx));
+    if (!idx) {
+        err = -ENOMEM;
+        goto out;
+    }
+    for (unsigned long i = 0; i < count; i++) {
+        int bin = migrate_status_bin(status[i], nodes[i]);
+        res->first[bin]++;
+        if (bin == MIGRATE_BIN_MOVED)
+            settle(res, 0, res->first_pass_ns);
+        else if (is_transient(status[i], nodes[i]))
+            idx[pending++] = i;
+    }
+    res->retried = pending;
+
+    if (pending) {
+        batch_pages = malloc(pending * sizeof(*batch_pages));
+        batch_nodes = malloc(pending * sizeof(*batch_nodes));
+        batch_status = malloc(pending * sizeof(*batch_status));
+        if (!batch_pages || !batch_nodes || !batch_status) {
+            err = -ENOMEM;
+            goto out;
+        }
+    }
+
+    unsigned backoff = policy->backoff_us;
+    for (int round = 1; pending && round <= max_retries; round++) {
+        uint64_t t = now_ns();
+        sleep_us(backoff);
+        res->backoff_ns += now_ns() - t;
+        backoff = backoff * 2 > policy->max_backoff_us ? policy->max_backoff_us : backoff * 2;
+
+        for (unsigned long k = 0; k < pending; k++) {
+            batch_pages[k] = pages[idx[k]];
+            batch_nodes[k] = nodes[idx[k]];
+        }
+        t = now_ns();
+        err = move_pass(pid, pending, batch_pages, batch_nodes, batch_status, policy, res);
+        res->retry_ns += now_ns() - t;
+        if (err)
+            goto out;
+
+        uint64_t elapsed = now_ns() - t0;
+        unsigned long still = 0;
+        for (unsigned long k = 0; k < pending; k++) {
+            unsigned long i = idx[k];
+            status[i] = batch_status[k];
+            if (status[i] == nodes[i])
+                settle(res, round, elapsed);
+            else if (is_transient(status[i], nodes[i]))
+                idx[still++] = i;
+        }
+        pending = still;
+        res->rounds = round;
+    }
+
+out:
+    res->total_ns = now_ns() - t0;
+    for (unsigned long i = 0; i < count && !err; i++) {
+        int bin = migrate_status_bin(status[i], nodes[i]);
+        res->final[bin]++;
+        if (bin == MIGRATE_BIN_MOVED)
+            res->moved++;
+        else
+            res->failed++;
+    }
+    free(batch_status);
+    free(batch_nodes);
+    free(batch_pages);
+    free(idx);
+    return err;
+}
+
+/*
+ * Fold @src, run concurrently with @dst, into @dst: page and call counts
+ * and the time spent in move_pages add up, wall times take the longest.
+ */
+void migrate_result_merge(struct migrate_result *dst, const struct migrate_result *src){
+    dst->pages += src->pages;
+    dst->moved += src->moved;
+    dst->failed += src->failed;
+    dst->retried += src->retried;
+    dst->calls += src->calls;
+    if (src->rounds > dst->rounds)
+        dst->rounds = src->rounds;
+    if (src->total_ns > dst->total_ns)
+        dst->total_ns = src->total_ns;
+    dst->first_pass_ns += src->first_pass_ns;
+    dst->retry_ns += src->retry_ns;
+    dst->backoff_ns += src->backoff_ns;
+    for (int b = 0; b < MIGRATE_NR_BINS; b++) {
+        dst->first[b] += src->first[b];
+        dst->final[b] += src->final[b];
+    }
+    for (int r = 0; r <= MIGRATE_MAX_ROUNDS; r++)
+        dst->settled_round[r] += src->settled_round[r];
+    for (int b = 0; b < MIGRATE_SETTLE_BUCKETS; b++)
+        dst->settle_us[b] += src->settle_us[b];
+    if (src->max_settle_ns > dst->max_settle_ns)
+        dst->max_settle_ns = src->max_settle_ns;
+}
+
+void migrate_result_print(FILE *out, const struct migrate_result *res){
+    char buf[32];
+
+    fprintf(out, "\n=== Migration Engine ===\n");
+    fprintf(out, "Pages: %lu, moved: %lu, failed: %lu, retried: %lu\n",
+            res->pages, res->moved, res->failed, res->retried);
+    fprintf(out, "move_pages calls: %lu, retry rounds: %d\n", res->calls, res->rounds);
+    fprintf(out, "Time: %.2f us total, %.2f us first pass, %.2f us retrying, %.2f us in backoff\n",
+            res->total_ns / 1e3, res->first_pass_ns / 1e3,
+            res->retry_ns / 1e3, res->backoff_ns / 1e3);
+
+    fprintf(out, "%-14s %10s %10s\n", "Status", "First", "Final");
+    for (int bin = 0; bin < MIGRATE_NR_BINS; bin++) {
+        if (res->first[bin] || res->final[bin])
+            fprintf(out, "%-14s %10lu %10lu\n", migrate_bin_name(bin, buf, sizeof(buf)),
+                    res->first[bin], res->final[bin]);
+    }
+
+    fprintf(out, "Settled by round:");
+    for (int r = 0; r <= res->rounds; r++)
+        fprintf(out, " %d:%lu", r, res->settled_round[r]);
+    fprintf(out, "\nTime to settle (us):\n");
+    for (int b = 0; b < MIGRATE_SETTLE_BUCKETS; b++) {
+        if (!res->settle_us[b])
+            continue;
+        fprintf(out, "  [%10lu, %10lu) %lu\n", b ? 1UL << (b - 1) : 0UL, 1UL << b, res->settle_us[b]);
+    }
+    fprintf(out, "  max %.2f us\n", res->max_settle_ns / 1e3);
+}
@@ -0,0 +1,63 @@
+#ifndef MIGRATE_ENGINE_H
+#define MIGRATE_ENGINE_H
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <numaif.h>
+
+/*
+ * move_pages(2) with retries.
+ *
+ * Pages whose status comes back as a transient error (-EBUSY, -EAGAIN,
+ * -ENOMEM) or that are still on the wrong node are gathered into a compact
+ * batch and retried after a bounded exponential backoff. Every other error
+ * is final. The result records a histogram of status codes for the first
+ * pass and after the last retry, and how long each page took to settle.
+ */
+
+#define MIGRATE_MAX_ERRNO     134          // EHWPOISON + 1
+#define MIGRATE_BIN_MOVED     0            // page is on its target node
+#define MIGRATE_BIN_WRONG     1            // page is on some other node
+#define MIGRATE_BIN_ERRNO(e)  (2 + (e))    // status == -e
+#define MIGRATE_NR_BINS       (2 + MIGRATE_MAX_ERRNO)
+#define MIGRATE_SETTLE_BUCKETS 32          // log2(us) buckets
+#define MIGRATE_MAX_ROUNDS    15           // upper bound for max_retries
+
+struct migrate_policy {
+    int max_retries;          // retry rounds after the first pass
+    unsigned backoff_us;      // sleep before the first retry
+    unsigned max_backoff_us;  // cap for the doubled sleep
+    unsigned long batch;      // pages per move_pages call, 0 for all at once
+    int flags;                // MPOL_MF_MOVE or MPOL_MF_MOVE_ALL
+};
+
+#define MIGRATE_POLICY_DEFAULT { 5, 100, 10000, 0, MPOL_MF_MOVE }
+
+struct migrate_result {
+    unsigned long pages;
+    unsigned long moved;      // on the target node at the end
+    unsigned long failed;     // still not moved at the end
+    unsigned long retried;    // pages that needed at least one retry
+    int rounds;               // retry rounds used
+    unsigned long calls;      // move_pages calls issued
+    uint64_t total_ns;        // wall time including backoff
+    uint64_t first_pass_ns;
+    uint64_t retry_ns;        // move_pages time in retry rounds
+    uint64_t backoff_ns;
+    uint64_t first[MIGRATE_NR_BINS];   // status histogram after the first pass
+    uint64_t final[MIGRATE_NR_BINS];   // status histogram after the last round
+    uint64_t settled_round[MIGRATE_MAX_ROUNDS + 1];  // pages that settled in round r (0 = first pass)
+    uint64_t settle_us[MIGRATE_SETTLE_BUCKETS];  // time to settle, log2(us) buckets
+    uint64_t max_settle_ns;
+};
+
+int migrate_status_bin(int status, int target);
+const char *migrate_bin_name(int bin, char *buf, size_t len);
+int migrate_pages_retry(pid_t pid, unsigned long count, void **pages, const int *nodes, int *status,
+                        const struct migrate_policy *policy, struct migrate_result *res);
+void migrate_result_merge(struct migrate_result *dst, const struct migrate_result *src);
+void migrate_result_print(FILE *out, const struct migrate_result *res);
+#endif
@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <numa.h>
+#include <numaif.h>
+#include "migrate_engine.h"
+#include "proc_maps.h"
+
+/*
+ * Online, rate-limited migration of another process's pages.
+ *
+ * Where `migratepages $pid 1 0` moves everything in one go, this walks the
+ * VMAs of the target from /proc/<pid>/maps, skips the ones numa_maps shows
+ * no pages for on the source nodes, and issues move_pages on fixed-size
+ * chunks of each VMA. After every chunk it sleeps long enough to keep the
+ * moved pages under the pages/s or MB/s budget.
+ */
+
+#define DEFAULT_CHUNK_PAGES 512
+
+struct chunk {
+    unsigned long start;
+    unsigned long pages;        // virtual pages covered
+    unsigned long page_size;
+    int vma;                    // index into the vma_list
+    double est_pages;           // pages expected on the source nodes
+};
+
+struct plan {
+    struct vma_list vmas;
+    struct chunk *chunks;
+    int nr_chunks;
+    int nr_vmas;                // VMAs with pages to move
+    unsigned long src_pages[PROC_MAX_NODES];
+    unsigned long total_pages;
+};
+
+struct pacer_config {
+    pid_t pid;
+    int from[PROC_MAX_NODES];
+    int nr_from;
+    int to;
+    double pages_per_sec;       // 0 for no page budget
+    double bytes_per_sec;       // 0 for no bandwidth budget
+    unsigned long chunk_pages;
+    double interval;            // seconds between progress lines
+    int dry_run;
+    struct migrate_policy policy;
+};
+
+struct progress {
+    unsigned long moved;
+    unsigned long failed;
+    unsigned long skipped;      // pages not present or already elsewhere
+    unsigned long moved_bytes;
+    unsigned long moved_from[PROC_MAX_NODES];
+    unsigned long calls;
+};
+
+static volatile sig_atomic_t stop;
+static void handle_int(int sig) { stop = 1; }
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int is_source(const struct pacer_config *cfg, int node) {
+    for (int i = 0; i < cfg->nr_from; i++) {
+        if (cfg->from[i] == node)
+            return 1;
+    }
+    return 0;
+}
+
+// Seconds the budget allows for having moved @pages pages / @bytes bytes
+static double budget_time(const struct pacer_config *cfg, double pages, double bytes) {
+    double t = 0;
+    if (cfg->pages_per_sec > 0)
+        t = pages / cfg->pages_per_sec;
+    if (cfg->bytes_per_sec > 0 && bytes / cfg->bytes_per_sec > t)
+        t = bytes / cfg->bytes_per_sec;
+    return t;
+}
+
+/**
+ * build_plan - Split every VMA holding pages on a source node into chunks
+ * of cfg->chunk_pages pages, with the number of source pages each chunk is
+ * expected to hold, spread evenly over the VMA.
+ */
+int build_plan(const struct pacer_config *cfg, struct plan *plan) {
+    memset(plan, 0, sizeof(*plan));
+    int err = proc_maps_read(cfg->pid, &plan->vmas);
+    if (err)
+        return err;
+
+    int cap = 0;
+    for (int v = 0; v < plan->vmas.nr; v++) {
+        const struct vma_info *vma = &plan->vmas.vmas[v];
+        unsigned long src = vma_pages_on(vma, cfg->from, cfg->nr_from);
+        if (!src || vma_is_special(vma))
+            continue;
+
+        plan->nr_vmas++;
+        for (int i = 0; i < cfg->nr_from; i++)
+            plan->src_pages[cfg->from[i]] += vma->node_pages[cfg->from[i]];
+        plan->total_pages += src;
+
+        unsigned long vpages = (vma->end - vma->start) / vma->page_size;
+        for (unsigned long off = 0; off < vpages; off += cfg->chunk_pages) {
+            if (plan->nr_chunks == cap) {
+                cap = cap ? 2 * cap : 256;
+                struct chunk *chunks = realloc(plan->chunks, cap * sizeof(*chunks));
+                if (!chunks)
+                    return -ENOMEM;
+                plan->chunks = chunks;
+            }
+            struct chunk *c = &plan->chunks[plan->nr_chunks++];
+            c->start = vma->start + off * vma->page_size;
+            c->pages = vpages - off < cfg->chunk_pages ? vpages - off : cfg->chunk_pages;
+            c->page_size = vma->page_size;
+            c->vma = v;
+            c->est_pages = (double)src * c->pages / vpages;
+        }
+    }
+    return 0;
+}
+
+void free_plan(struct plan *plan) {
+    free(plan->chunks);
+    vma_list_free(&plan->vmas);
+}
+
+static void print_nodes(const struct pacer_config *cfg, const unsigned long *pages) {
+    for (int i = 0; i < cfg->nr_from; i++)
+        printf(" N%d=%lu", cfg->from[i], pages[cfg->from[i]]);
+}
+
+void print_plan(const struct pacer_config *cfg, const struct plan *plan) {
+    double bytes = 0;
+    for (int i = 0; i < plan->nr_chunks; i++)
+        bytes += plan->chunks[i].est_pages * plan->chunks[i].page_size;
+
+    printf("Plan for pid %d: %d VMAs, %d chunks, %lu pages to node %d:",
+           cfg->pid, plan->nr_vmas, plan->nr_chunks, plan->total_pages, cfg->to);
+    print_nodes(cfg, plan->src_pages);
+    printf("\n");
+    if (cfg->pages_per_sec > 0 || cfg->bytes_per_sec > 0) {
+        printf("Budget:");
+        if (cfg->pages_per_sec > 0)
+            printf(" %.0f pages/s", cfg->pages_per_sec);
+        if (cfg->bytes_per_sec > 0)
+            printf(" %.2f MB/s", cfg->bytes_per_sec / (1024 * 1024));
+        printf(" => ETA %.1f s\n", budget_time(cfg, plan->total_pages, bytes));
+    } else {
+        printf("Budget: unlimited\n");
+    }
+
+    if (!cfg->dry_run)
+        return;
+
+    double pages = 0;
+    bytes = 0;
+    printf("%10s %18s %18s %8s %10s %8s  %s\n", "T+(s)", "START", "END", "PAGES", "EST-MOVE", "PGSIZE", "VMA");
+    for (int i = 0; i < plan->nr_chunks; i++) {
+        const struct chunk *c = &plan->chunks[i];
+        const struct vma_info *vma = &plan->vmas.vmas[c->vma];
+        printf("%10.3f %#18lx %#18lx %8lu %10.1f %8lu  %s\n",
+               budget_time(cfg, pages, bytes), c->start, c->start + c->pages * c->page_size,
+               c->pages, c->est_pages, c->page_size, vma->path[0] ? vma->path : "[anon]");
+        pages += c->est_pages;
+        bytes += c->est_pages * c->page_size;
+    }
+}
+
+static void print_progress(const struct pacer_config *cfg, const struct plan *plan,
+                           const struct progress *p, double elapsed) {
+    unsigned long remaining[PROC_MAX_NODES] = {0};
+    for (int i = 0; i < cfg->nr_from; i++) {
+        int n = cfg->from[i];
+        remaining[n] = plan->src_pages[n] > p->moved_from[n] ? plan->src_pages[n] - p->moved_from[n] : 0;
+    }
+    printf("[%8.2fs] moved %lu (%.1f pages/s, %.2f MB/s), failed %lu, skipped %lu, calls %lu, remaining:",
+           elapsed, p->moved, elapsed > 0 ? p->moved / elapsed : 0.0,
+           elapsed > 0 ? p->moved_bytes / elapsed / (1024 * 1024) : 0.0,
+           p->failed, p->skipped, p->calls);
+    print_nodes(cfg, remaining);
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * run_plan - Execute the chunks in order under the budget.
+ *
+ * Each chunk is first queried with move_pages(nodes = NULL) so that only
+ * pages that currently sit on a source node are passed on for migration.
+ */
+int run_plan(const struct pacer_config *cfg, const struct plan *plan, struct progress *p) {
+    unsigned long max_pages = cfg->chunk_pages;
+    void **addrs = malloc(max_pages * sizeof(*addrs));
+    void **sel = malloc(max_pages * sizeof(*sel));
+    int *where = malloc(max_pages * sizeof(*where));
+    int *from = malloc(max_pages * sizeof(*from));
+    int *nodes = malloc(max_pages * sizeof(*nodes));
+    int *status = malloc(max_pages * sizeof(*status));
+    int err = 0;
+
+    if (!addrs || !sel || !where || !from || !nodes || !status) {
+        err = -ENOMEM;
+        goto out;
+    }
+    for (unsigned long i = 0; i < max_pages; i++)
+        nodes[i] = cfg->to;
+
+    memset(p, 0, sizeof(*p));
+    double t0 = now_sec();
+    double next_report = cfg->interval;
+
+    for (int ci = 0; ci < plan->nr_chunks && !stop; ci++) {
+        const struct chunk *c = &plan->chunks[ci];
+        for (unsigned long i = 0; i < c->pages; i++)
+            addrs[i] = (void *)(c->start + i * c->page_size);
+
+        p->calls++;
+        if (move_pages(cfg->pid, c->pages, addrs, NULL, where, 0) < 0) {
+            err = -errno;
+            break;
+        }
+        unsigned long n = 0;
+        for (unsigned long i = 0; i < c->pages; i++) {
+            if (where[i] >= 0 && is_source(cfg, where[i])) {
+                sel[n] = addrs[i];
+                from[n++] = where[i];
+            } else {
+                p->skipped++;
+            }
+        }
+        if (n) {
+            struct migrate_result res;
+            err = migrate_pages_retry(cfg->pid, n, sel, nodes, status, &cfg->policy, &res);
+            if (err)
+                break;
+            p->calls += res.calls;
+            p->moved += res.moved;
+            p->failed += res.failed;
+            p->moved_bytes += res.moved * c->page_size;
+            for (unsigned long i = 0; i < n; i++) {
+                if (status[i] == cfg->to && from[i] < PROC_MAX_NODES)
+                    p->moved_from[from[i]]++;
+            }
+        }
+
+        // Pace: sleep until the budget allows what has been moved so far
+        double elapsed = now_sec() - t0;
+        double wait = budget_time(cfg, p->moved, p->moved_bytes) - elapsed;
+        if (wait > 0) {
+            struct timespec ts = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+            nanosleep(&ts, NULL);
+            elapsed = now_sec() - t0;
+        }
+        if (elapsed >= next_report) {
+            print_progress(cfg, plan, p, elapsed);
+            next_report = elapsed + cfg->interval;
+        }
+    }
+    print_progress(cfg, plan, p, now_sec() - t0);
+
+out:
+    free(status);
+    free(nodes);
+    free(from);
+    free(where);
+    free(sel);
+    free(addrs);
+    return err;
+}
+
+static int parse_nodes(const char *s, int *nodes, int max) {
+    int n = 0;
+    char *end;
+    while (*s && n < max) {
+        nodes[n++] = strtol(s, &end, 10);
+        if (end == s)
+            return -1;
+        s = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s -p pid -f from[,from...] -t to [-r pages/s] [-w MB/s] [-c chunk_pages]\n"
+            "          [-i interval_s] [-R retries] [-n]\n"
+            "  -r  budget in migrated pages per second\n"
+            "  -w  budget in migrated MB per second\n"
+            "  -c  pages per move_pages chunk (default: %d)\n"
+            "  -i  seconds between progress lines (default: 1)\n"
+            "  -R  retry rounds for pages that fail with EBUSY/EAGAIN/ENOMEM\n"
+            "  -n  dry run: print the full schedule without moving anything\n",
+            prog, DEFAULT_CHUNK_PAGES);
+}
+
+int main(int argc, char *argv[]) {
+    struct pacer_config cfg = {
+        .pid = -1,
+        .to = -1,
+        .chunk_pages = DEFAULT_CHUNK_PAGES,
+        .interval = 1.0,
+        .policy = MIGRATE_POLICY_DEFAULT,
+    };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:f:t:r:w:c:i:R:nh")) != -1) {
+        switch (opt) {
+        case 'p':
+            cfg.pid = atoi(optarg);
+            break;
+        case 'f':
+            cfg.nr_from = parse_nodes(optarg, cfg.from, PROC_MAX_NODES);
+            break;
+        case 't':
+            cfg.to = atoi(optarg);
+            break;
+        case 'r':
+            cfg.pages_per_sec = atof(optarg);
+            break;
+        case 'w':
+            cfg.bytes_per_sec = atof(optarg) * 1024 * 1024;
+            break;
+        case 'c':
+            cfg.chunk_pages = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            cfg.interval = atof(optarg);
+            break;
+        case 'R':
+            cfg.policy.max_retries = atoi(optarg);
+            break;
+        case 'n':
+            cfg.dry_run = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (cfg.pid <= 0 || cfg.nr_from <= 0 || cfg.to < 0 || cfg.chunk_pages == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (int i = 0; i < cfg.nr_from; i++) {
+        if (cfg.from[i] < 0 || cfg.from[i] >= PROC_MAX_NODES) {
+            fprintf(stderr, "Invalid source node %d\n", cfg.from[i]);
+            return 1;
+        }
+    }
+    if (!cfg.dry_run && (numa_available() < 0 || numa_max_node() < cfg.to)) {
+        fprintf(stderr, "Target node %d not available\n", cfg.to);
+        return 1;
+    }
+
+    struct plan plan;
+    int err = build_plan(&cfg, &plan);
+    if (err) {
+        fprintf(stderr, "Cannot read the address space of %d: %s\n", cfg.pid, strerror(-err));
+        free_plan(&plan);
+        return 1;
+    }
+    print_plan(&cfg, &plan);
+    if (cfg.dry_run) {
+        free_plan(&plan);
+        return 0;
+    }
+
+    signal(SIGINT, handle_int);
+    signal(SIGTERM, handle_int);
+
+    struct progress progress;
+    err = run_plan(&cfg, &plan, &progress);
+    if (err)
+        fprintf(stderr, "move_pages: %s\n", strerror(-err));
+    free_plan(&plan);
+    return err ? 1 : 0;
+}
@@ -10,21 +10,74 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <sched.h>
+#include <pthread.h>
 #include <immintrin.h> // For _mm_lfence() on some compilers, or use inline asm
 #include "perf_events.h"
+#include "migrate_engine.h"
 
 
 // A simple way to create a marker for perf to probe.
 // The "nop" instruction is a placeholder that does nothing.
 // We can instruct perf to record an event every time this line is executed.
 #define PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE (2UL << 20)   // PMD-sized THP on x86-64 and arm64 4K
 #define MAX_NODES 8
-#define NUM_EVENTS 5
+// Kprobes share one group; each PMU event gets its own group so that the
+// kernel can multiplex them and the counts can be scaled.
+#define DEFAULT_EVENTS "{kprobe:handle_mm_fault,kprobe:remove_migration_pte}," \
+                       "dTLB-loads:u,dTLB-load-misses:u"
+// Load-latency events by vendor, tried in order for -s
+#define DEFAULT_SAMPLE_EVENTS "cpu/mem-loads,ldlat=30/u;cpu_core/mem-loads,ldlat=30/u;ibs_op//"
+#define DEFAULT_SAMPLE_PERIOD 97
+
+// How the pages are moved
+enum engine {
+    ENGINE_MOVE_PAGES,      // move_pages(2) through the retry engine
+    ENGINE_MBIND,           // mbind(2) MPOL_BIND with MPOL_MF_MOVE on each slice
+    ENGINE_MIGRATE_PAGES,   // migrate_pages(2): every page of the process, one call
+    ENGINE_NR,
+};
+
+static const char *const engine_names[ENGINE_NR] = {
+    [ENGINE_MOVE_PAGES]    = "move_pages",
+    [ENGINE_MBIND]         = "mbind",
+    [ENGINE_MIGRATE_PAGES] = "migrate_pages",
+};
+
+// Where and how perform_migration() measures the run
+struct run_config {
+    const struct perf_event_list *events;
+    enum perf_scope scope;
+    int cpu;
+    int sample;                                 // sample data addresses while touching pages
+    const struct perf_event_spec *sample_event; // NULL: sample page faults
+    int sample_strict;                          // -E given: no fallback to page faults
+    uint64_t sample_period;
+    unsigned sample_pages;                      // ring buffer size
+    struct migrate_policy policy;               // retries for failed pages
+    const char *csv;                            // append a row per run, for cost_model fit
+    enum engine engine;
+    int threads;                                // each moves its own slice of the pages
+    int quiet;                                  // no per-page listings
+};
+
+// Sampled accesses joined against the migrated pages and their nodes
+struct sample_report {
+    const struct migration_test *test;
+    const int *nodes;       // node of each page after migration
+    uint64_t total;
+    uint64_t outside;       // samples not on a migrated page
+    uint64_t samples[MAX_NODES];
+    uint64_t weight[MAX_NODES];
+    uint64_t src[MAX_NODES][PERF_MEM_SRC_MAX];
+};
 
 struct migration_test {
     void *memory;
     size_t total_size;
+    size_t page_size;       // PAGE_SIZE, or HUGE_PAGE_SIZE for THP-backed runs
     int num_pages;
+    int source_node;
     void **page_addrs;
     int *target_nodes;
     int *status_before;
@@ -33,16 +86,6 @@ struct migration_test {
     struct timespec end_time;
 };
 
-// You would also need this helper function in your file
-int get_kprobe_pmu_type(void) {
-    FILE *f = fopen("/sys/bus/event_source/devices/kprobe/type", "r");
-    int type = -1;
-    if (!f) { return -1; /* error handling */ }
-    if (fscanf(f, "%d", &type) != 1) { type = -1; /* error handling */ }
-    fclose(f);
-    return type;
-}
-
 /**
  * touch_migrated_pages_decoupled - Decouples pointer and data accesses.
  *
@@ -54,7 +97,9 @@ int get_kprobe_pmu_type(void) {
  * migrated pages. By measuring only this second loop, we can isolate the
  * DTLB misses caused exclusively by re-faulting on the migrated data pages.
  */
-long touch_migrated_pages_decoupled(struct migration_test *test, int group_fd) {
+long touch_migrated_pages_decoupled(struct migration_test *test, struct perf_set *perf,
+                                    struct perf_sampler *sampler) {
+    // perf is NULL when nothing is counted (-e none)
     volatile long verification_sum = 0;
 
     // Create a stack-allocated array to hold the pointers.
@@ -75,7 +120,13 @@ long touch_migrated_pages_decoupled(struct migration_test *test, int group_fd) {
     // Insert a memory fence to ensure all warm-up loads are complete.
     asm volatile ("mfence" ::: "memory");
 
-    reset_and_enable_ioctl(group_fd);
+    if (perf && (perf_set_reset(perf) || perf_set_enable(perf))) {
+        perror("perf_set_enable");
+        free(local_page_addrs);
+        return -1;
+    }
+    if (sampler)
+        perf_sampler_enable(sampler);
     for (int i = 0; i < num_pages; i++) {
         // Now we are accessing the local array, which should be hot in the cache/TLB.
         volatile char *page_ptr = (volatile char *)local_page_addrs[i];
@@ -85,7 +136,10 @@ long touch_migrated_pages_decoupled(struct migration_test *test, int group_fd) {
         asm volatile ("lfence" ::: "memory");
     }
 
-    disable_ioctl(group_fd);
+    if (perf)
+        perf_set_disable(perf);
+    if (sampler)
+        perf_sampler_disable(sampler);
 
     free(local_page_addrs);
 
@@ -155,9 +209,31 @@ void pin_to_cpu(int cpu_id) {
     }
 }
 
-// Allocate memory on specific NUMA node
-void* allocate_on_node(size_t size, int node) {
+// Allocate memory on specific NUMA node, THP-backed when huge is set
+// AnonHugePages of the mapping that holds @addr, in bytes, or -errno
+static long anon_huge_bytes(const void *addr) {
+    FILE *f = fopen("/proc/self/smaps", "r");
+    char line[256];
+    unsigned long start, end, kb;
+    int in = 0;
+
+    if (!f)
+        return -errno;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+            in = (uintptr_t)addr >= start && (uintptr_t)addr < end;
+        else if (in && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            fclose(f);
+            return kb * 1024;
+        }
+    }
+    fclose(f);
+    return -ENOENT;
+}
+
+void* allocate_on_node(size_t size, int node, int huge) {
     void *mem;
+    size_t align = huge ? HUGE_PAGE_SIZE : 0;
     
     // Set memory policy to allocate on specific node
     unsigned long nodemask = 1UL << node;
@@ -167,12 +243,24 @@ void* allocate_on_node(size_t size, int node) {
     }
     
     // Allocate and touch memory
-    mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    mem = mmap(NULL, size + align, PROT_READ | PROT_WRITE,
                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (mem == MAP_FAILED) {
         perror("mmap");
+        set_mempolicy(MPOL_DEFAULT, NULL, 0);
         return NULL;
     }
+
+    // THPs need a PMD-aligned range: trim the slack on both sides
+    if (huge) {
+        char *start = (char *)(((uintptr_t)mem + align - 1) & ~(align - 1));
+        if (start != (char *)mem)
+            munmap(mem, start - (char *)mem);
+        munmap(start + size, (char *)mem + align - start);
+        mem = start;
+        if (madvise(mem, size, MADV_HUGEPAGE) != 0)
+            perror("madvise(MADV_HUGEPAGE)");
+    }
     
     // Touch every page to ensure allocation
     for (size_t i = 0; i < size; i += PAGE_SIZE) {
@@ -181,17 +269,33 @@ void* allocate_on_node(size_t size, int node) {
     
     // Reset memory policy
     set_mempolicy(MPOL_DEFAULT, NULL, 0);
+
+    // Without THPs a -H run would time base pages as if they were huge
+    if (huge) {
+        long thp = anon_huge_bytes(mem);
+        if (thp < (long)size) {
+            if (thp < 0)
+                fprintf(stderr, "THP check: /proc/self/smaps: %s\n", strerror(-thp));
+            else
+                fprintf(stderr, "only %ld of %zu bytes are THP-backed, check "
+                        "/sys/kernel/mm/transparent_hugepage/enabled\n", thp, size);
+            munmap(mem, size);
+            return NULL;
+        }
+    }
     
     return mem;
 }
 
 // Initialize migration test structure
-struct migration_test* init_migration_test(int num_pages, int source_node, int target_node) {
+struct migration_test* init_migration_test(int num_pages, int source_node, int target_node, int huge) {
     struct migration_test *test = calloc(1, sizeof(struct migration_test));
     if (!test) return NULL;
     
     test->num_pages = num_pages;
-    test->total_size = num_pages * PAGE_SIZE;
+    test->source_node = source_node;
+    test->page_size = huge ? HUGE_PAGE_SIZE : PAGE_SIZE;
+    test->total_size = num_pages * test->page_size;
     
     // Allocate arrays
     test->page_addrs = malloc(num_pages * sizeof(void*));
@@ -205,7 +309,7 @@ struct migration_test* init_migration_test(int num_pages, int source_node, int t
     }
     
     // Allocate memory on source node
-    test->memory = allocate_on_node(test->total_size, source_node);
+    test->memory = allocate_on_node(test->total_size, source_node, huge);
     if (!test->memory) {
         free(test);
         return NULL;
@@ -213,7 +317,7 @@ struct migration_test* init_migration_test(int num_pages, int source_node, int t
     
     // Set up page addresses and target nodes
     for (int i = 0; i < num_pages; i++) {
-        test->page_addrs[i] = (char*)test->memory + i * PAGE_SIZE;
+        test->page_addrs[i] = (char*)test->memory + i * test->page_size;
         test->target_nodes[i] = target_node;
     }
     
@@ -225,58 +329,327 @@ int query_page_locations(struct migration_test *test, int *status_array) {
     return move_pages(0, test->num_pages, test->page_addrs, NULL, status_array, 0);
 }
 
-// Perform the actual migration with timing
-int perform_migration(struct migration_test *test) {
-    int kprobe_type = get_kprobe_pmu_type();
+static int account_sample(const struct perf_sample *sample, void *ctx) {
+    struct sample_report *r = ctx;
+    const struct migration_test *test = r->test;
+    uintptr_t base = (uintptr_t)test->memory;
 
-    if (kprobe_type < 0) {
-        exit(EXIT_FAILURE);
+    r->total++;
+    if (sample->addr < base || sample->addr >= base + test->total_size) {
+        r->outside++;
+        return 0;
     }
+    int node = r->nodes[(sample->addr - base) / test->page_size];
+    if (node < 0 || node >= MAX_NODES) {
+        r->outside++;
+        return 0;
+    }
+    r->samples[node]++;
+    r->weight[node] += sample->weight;
+    r->src[node][perf_mem_classify(sample->data_src)]++;
+    return 0;
+}
 
-    const char *func_to_probe = "remove_migration_pte";
-    const char *func_to_probe2 = "handle_mm_fault";
-    char* names[NUM_EVENTS] = {
-        func_to_probe2,
-        func_to_probe,
-        "MEM_INST_RETIRED.STLB_MISS_LOADS",
-        "DLTB_LOAD_MISSES.COMPLETED_WALKS",
-        "TLB Flushes"
-    };
-    uint64_t types[NUM_EVENTS] = {
-        kprobe_type,
-        kprobe_type,
-        PERF_TYPE_RAW,
-        PERF_TYPE_RAW,
-        PERF_TYPE_RAW
-    };
-    uint64_t configs[NUM_EVENTS] = {
-        (uint64_t)func_to_probe,
-        (uint64_t)func_to_probe,
-        0x11D0,
-        0x208,
-        0x1BD
-    };
+/*
+ * A software sampler only sees page faults, and the touch after the move
+ * takes none: the pages are mapped again by then.  Sample their first touch
+ * instead, dropping the pages and faulting them back in on the source node
+ * before the move.
+ */
+static int refault_sampled(struct migration_test *test, struct perf_sampler *sampler) {
+    unsigned long nodemask = 1UL << test->source_node;
+    int err;
+
+    if (madvise(test->memory, test->total_size, MADV_DONTNEED) != 0)
+        return -errno;
+    if (set_mempolicy(MPOL_BIND, &nodemask, test->source_node + 2) != 0)
+        return -errno;
+    err = perf_sampler_enable(sampler);
+    if (!err) {
+        for (size_t off = 0; off < test->total_size; off += PAGE_SIZE)
+            *((volatile char *)test->memory + off) = 0x42;
+        perf_sampler_disable(sampler);
+    }
+    set_mempolicy(MPOL_DEFAULT, NULL, 0);
+    return err;
+}
+
+/**
+ * report_samples - Attribute sampled loads to the node each migrated page
+ * ended up on, and show whether the loads were served from local DRAM.
+ */
+void report_samples(struct migration_test *test, struct perf_sampler *sampler,
+                    const struct run_config *cfg, const int *nodes, int cpu) {
+    struct sample_report r = { .test = test, .nodes = nodes };
+    int local_node = numa_node_of_cpu(cpu);
+
+    int err = perf_sampler_consume(sampler, account_sample, &r);
+    if (err < 0) {
+        fprintf(stderr, "perf_sampler_consume: %s\n", strerror(-err));
+        return;
+    }
+
+    printf("\n=== Sampled Accesses (%s, %s, period %lu) ===\n",
+           perf_sample_mode_name(sampler->mode),
+           sampler->mode == PERF_SAMPLE_MODE_SOFTWARE || !cfg->sample_event ?
+           "page-faults" : cfg->sample_event->name, sampler->period);
+    printf("Samples: %lu (%lu outside migrated pages, %lu lost)\n", r.total, r.outside, sampler->lost);
+    printf("%-10s %8s %10s", "Node", "Samples", "AvgWeight");
+    for (int s = 0; s < PERF_MEM_SRC_MAX; s++)
+        printf(" %12s", perf_mem_source_name(s));
+    printf("\n");
+
+    for (int node = 0; node < MAX_NODES; node++) {
+        if (!r.samples[node])
+            continue;
+        printf("%-4d%-6s %8lu %10.1f", node, node == local_node ? "(cpu)" : "",
+               r.samples[node], (double)r.weight[node] / r.samples[node]);
+        for (int s = 0; s < PERF_MEM_SRC_MAX; s++)
+            printf(" %12lu", r.src[node][s]);
+        printf("\n");
+
+        uint64_t dram = r.src[node][PERF_MEM_SRC_LOCAL_RAM] + r.src[node][PERF_MEM_SRC_REMOTE_RAM];
+        if (dram)
+            printf("           DRAM loads served locally: %.1f%%\n",
+                   100.0 * r.src[node][PERF_MEM_SRC_LOCAL_RAM] / dram);
+    }
+    if (sampler->mode == PERF_SAMPLE_MODE_SOFTWARE)
+        printf("(software sampling: first-touch faults before the move, on the node each page\n"
+               " was placed on; no data source)\n");
+    else if (!(sampler->sample_type & PERF_SAMPLE_DATA_SRC))
+        printf("(the PMU gave no data source or weight for this event)\n");
+}
+
+/*
+ * Append this run to @path, writing the header when the file is new.  The
+ * latency is the time spent in the engine's calls, summed over threads and
+ * without the retry backoff.  migrate_pages moves the whole process: its
+ * pages, moved and failed count the test's pages only, not everything the
+ * call moved, so its times are not per-page figures.
+ */
+static void append_csv(const char *path, const struct migration_test *test,
+                       const struct run_config *cfg, const struct migrate_result *res) {
+    FILE *f = fopen(path, "a");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    if (ftell(f) == 0)
+        fprintf(f, "# page_migrations v1\n"
+                "pages,page_size,batch,calls,moved,failed,move_ns,total_ns,engine,threads\n");
+    fprintf(f, "%lu,%zu,%lu,%lu,%lu,%lu,%llu,%llu,%s,%d\n", res->pages, test->page_size,
+            cfg->policy.batch ? cfg->policy.batch : (unsigned long)test->num_pages, res->calls,
+            res->moved, res->failed, (unsigned long long)(res->first_pass_ns + res->retry_ns),
+            (unsigned long long)res->total_ns, engine_names[cfg->engine],
+            cfg->engine == ENGINE_MIGRATE_PAGES ? 1 : cfg->threads);
+    fclose(f);
+}
+
+/*
+ * A thread moving pages [first, first + count) of the test with the
+ * configured engine; with one thread it runs on the caller.
+ */
+struct migrate_worker {
+    pthread_t thread;
+    struct migration_test *test;
+    const struct run_config *cfg;
+    unsigned long first, count;
+    int cpu;                    // pinned here, -1 to stay where the caller is
+    int err;                    // -errno
+    struct migrate_result res;
+};
+
+static uint64_t elapsed_ns(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1000000000ULL + t1.tv_nsec - t0->tv_nsec;
+}
+
+// Account where the pages of a one-shot engine ended up, as the retry engine does
+static int account_status(struct migrate_worker *w) {
+    struct migrate_result *res = &w->res;
+    void **pages = w->test->page_addrs + w->first;
+    int *status = w->test->status_after + w->first;
+    const int *nodes = w->test->target_nodes + w->first;
+
+    if (move_pages(0, w->count, pages, NULL, status, 0) != 0)
+        return -errno;
+    for (unsigned long i = 0; i < w->count; i++) {
+        int bin = migrate_status_bin(status[i], nodes[i]);
+        res->first[bin]++;
+        res->final[bin]++;
+        if (bin == MIGRATE_BIN_MOVED) {
+            res->moved++;
+            res->settled_round[0]++;
+        } else {
+            res->failed++;
+        }
+    }
+    res->max_settle_ns = res->total_ns;
+    return 0;
+}
+
+static void *run_worker(void *arg) {
+    struct migrate_worker *w = arg;
+    struct migration_test *test = w->test;
+    const struct run_config *cfg = w->cfg;
+    int target = test->target_nodes[w->first], source = test->status_before[w->first];
+    unsigned long to = 1UL << target, from = source >= 0 ? 1UL << source : to;
+    struct timespec t0;
+    long ret = 0;
+
+    if (w->cpu >= 0)
+        pin_to_cpu(w->cpu);
+    memset(&w->res, 0, sizeof(w->res));
+    w->res.pages = w->count;
+
+    switch (cfg->engine) {
+    case ENGINE_MOVE_PAGES:
+        w->err = migrate_pages_retry(0, w->count, test->page_addrs + w->first,
+                                     test->target_nodes + w->first, test->status_after + w->first,
+                                     &cfg->policy, &w->res);
+        return NULL;
+    case ENGINE_MBIND:
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        ret = mbind(test->page_addrs[w->first], w->count * test->page_size, MPOL_BIND,
+                    &to, target + 2, cfg->policy.flags);
+        break;
+    case ENGINE_MIGRATE_PAGES:
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        ret = migrate_pages(0, MAX_NODES + 1, &from, &to);
+        break;
+    default:
+        w->err = -EINVAL;
+        return NULL;
+    }
+    w->res.total_ns = w->res.first_pass_ns = elapsed_ns(&t0);
+    w->res.calls = 1;
+    if (ret < 0) {
+        w->err = -errno;
+        return NULL;
+    }
+    w->err = account_status(w);
+    return NULL;
+}
+
+/*
+ * Move every page of @test with @cfg->engine, split across @cfg->threads
+ * threads pinned to consecutive CPUs from @cpu_pin.  Counts in @res add up
+ * over the threads, times in move_pages too; total_ns is the wall time.
+ */
+static int run_migration(struct migration_test *test, const struct run_config *cfg, int cpu_pin,
+                         struct migrate_result *res) {
+    // migrate_pages(2) moves the whole process at once
+    int threads = cfg->engine == ENGINE_MIGRATE_PAGES ? 1 : cfg->threads;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    struct migrate_worker *w;
+    struct timespec t0;
+    int err = 0;
+
+    if (threads > test->num_pages)
+        threads = test->num_pages;
+    if (threads < 1)
+        threads = 1;
+    w = calloc(threads, sizeof(*w));
+    if (!w)
+        return -ENOMEM;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < threads; i++) {
+        w[i].test = test;
+        w[i].cfg = cfg;
+        w[i].first = (unsigned long)test->num_pages * i / threads;
+        w[i].count = (unsigned long)test->num_pages * (i + 1) / threads - w[i].first;
+        w[i].cpu = threads > 1 ? (cpu_pin + i) % cpus : -1;
+        if (threads == 1 || pthread_create(&w[i].thread, NULL, run_worker, &w[i])) {
+            // no thread: run the slice here rather than leave it out
+            w[i].thread = 0;
+            run_worker(&w[i]);
+        }
+    }
+    memset(res, 0, sizeof(*res));
+    for (int i = 0; i < threads; i++) {
+        if (threads > 1 && w[i].thread)
+            pthread_join(w[i].thread, NULL);
+        migrate_result_merge(res, &w[i].res);
+        if (w[i].err && !err)
+            err = w[i].err;
+    }
+    res->total_ns = elapsed_ns(&t0);
+    free(w);
+    return err;
+}
+
+static void print_locations(struct migration_test *test, const char *title, const int *status) {
+    printf("%s - Page locations:\n", title);
+    for (int i = 0; i < test->num_pages; i++) {
+        printf("  Page %d: Node %d, VAddr: %p\n", i, status[i], test->page_addrs[i]);
+    }
+}
 
-    struct perf_event_attr pe;
-    int fds[NUM_EVENTS];
-    uint64_t ids[NUM_EVENTS];
-    int group_fd;
+// Perform the actual migration with timing
+int perform_migration(struct migration_test *test, const struct run_config *cfg, int cpu_pin) {
+    const struct perf_event_list *events = cfg->events;
+    struct perf_set perf;
+    struct perf_set *pp = NULL;
+    struct perf_sampler sampler;
+    struct perf_sampler *sp = NULL;
+    struct perf_count *counts = NULL;
+    int ret = -1;
+
+    if (events->nr) {
+        printf("Configuring %d perf events...\n", events->nr);
+        int err = perf_set_open(&perf, events->specs, events->nr, cfg->scope, 0, cfg->cpu);
+        if (err) {
+            fprintf(stderr, "Error opening event #%d (%s): %s\n", perf.failed_idx,
+                    perf.failed_idx >= 0 ? events->specs[perf.failed_idx].name : "?", strerror(-err));
+            return -1;
+        }
+        pp = &perf;
+        counts = calloc(events->nr, sizeof(*counts));
+        if (!counts) {
+            perror("calloc");
+            goto out;
+        }
+    }
 
-    printf("Configuring %d perf events...\n", NUM_EVENTS);
-    group_fd = config_perf_multi(&pe, fds, ids, types, configs, kprobe_type, NUM_EVENTS);
+    if (cfg->sample) {
+        int err = perf_sampler_open(&sampler, cfg->sample_event, cfg->sample_period, 0, -1, cfg->sample_pages);
+        if (err) {
+            fprintf(stderr, "Cannot open sampling event: %s\n", strerror(-err));
+            goto out;
+        }
+        sp = &sampler;
+        // an explicit -E event the PMU cannot sample is an error, not page faults
+        if (cfg->sample_strict && sampler.mode == PERF_SAMPLE_MODE_SOFTWARE &&
+            cfg->sample_event->type != PERF_TYPE_SOFTWARE) {
+            fprintf(stderr, "Cannot sample %s on this PMU\n", cfg->sample_event->name);
+            goto out;
+        }
+        printf("Sampling data addresses (%s mode)\n", perf_sample_mode_name(sampler.mode));
+        if (sampler.mode == PERF_SAMPLE_MODE_SOFTWARE) {
+            printf("Page faults are sampled while the pages are populated again before the move\n");
+            int err = refault_sampled(test, &sampler);
+            if (err) {
+                fprintf(stderr, "Re-populating the pages: %s\n", strerror(-err));
+                goto out;
+            }
+        }
+    }
+    // the touch after the move is sampled only by a PMU sampler
+    struct perf_sampler *touch_sp = sp && sampler.mode != PERF_SAMPLE_MODE_SOFTWARE ? sp : NULL;
 
-    printf("Starting migration of %d pages...\n", test->num_pages);
+    printf("Starting migration of %d pages (%s, %zu KB pages, %d threads)...\n", test->num_pages,
+           engine_names[cfg->engine], test->page_size / 1024, cfg->threads);
     
     // Query initial locations
     if (query_page_locations(test, test->status_before) != 0) {
         perror("Failed to query initial page locations");
-        return -1;
+        goto out;
     }
     
-    printf("Before migration - Page locations:\n");
-    for (int i = 0; i < test->num_pages; i++) {
-        printf("  Page %d: Node %d, VAddr: %p\n", i, test->status_before[i], test->page_addrs[i]);
-    }
+    if (!cfg->quiet)
+        print_locations(test, "Before migration", test->status_before);
     
     // Synchronization point - ensure clean start
     sync();
@@ -285,53 +658,63 @@ int perform_migration(struct migration_test *test) {
     // Start timing
     clock_gettime(CLOCK_MONOTONIC, &test->start_time);
     
-    // reset_and_enable_ioctl(group_fd);
     // Perform migration
-    int result = move_pages(0, test->num_pages, test->page_addrs, 
-                           test->target_nodes, test->status_after, MPOL_MF_MOVE);
-    // disable_ioctl(group_fd);
+    struct migrate_result mres;
+    int result = run_migration(test, cfg, cpu_pin, &mres);
     
     printf("Workload finished.\n");
 
-    // reset_and_enable_ioctl(group_fd);
-
-    touch_migrated_pages_decoupled(test, group_fd);
-
-    // disable_ioctl(group_fd);
-
+    touch_migrated_pages_decoupled(test, pp, touch_sp);
 
     // End timing
     clock_gettime(CLOCK_MONOTONIC, &test->end_time);
     
     if (result != 0) {
-        perror("move_pages failed");
-        printf("Detailed status:\n");
-        for (int i = 0; i < test->num_pages; i++) {
-            printf("  Page %d: Status %d\n", i, test->status_after[i]);
+        fprintf(stderr, "%s failed: %s\n", engine_names[cfg->engine], strerror(-result));
+        if (!cfg->quiet) {
+            printf("Detailed status:\n");
+            for (int i = 0; i < test->num_pages; i++) {
+                printf("  Page %d: Status %d\n", i, test->status_after[i]);
+            }
         }
-        return -1;
+        goto out;
     }
     
+    migrate_result_print(stdout, &mres);
+    if (cfg->csv)
+        append_csv(cfg->csv, test, cfg, &mres);
+
     // Verify migration
     int *verify_status = malloc(test->num_pages * sizeof(int));
-    if (query_page_locations(test, verify_status) == 0) {
-        printf("After migration - Page locations:\n");
-        for (int i = 0; i < test->num_pages; i++) {
-            printf("  Page %d: Node %d, Addr: %p\n", i, verify_status[i], test->page_addrs[i]);
-        }
+    if (verify_status && query_page_locations(test, verify_status) == 0) {
+        if (!cfg->quiet)
+            print_locations(test, "After migration", verify_status);
+        // faults were sampled before the move, on the pages' source nodes
+        if (sp)
+            report_samples(test, sp, cfg, sampler.mode == PERF_SAMPLE_MODE_SOFTWARE ?
+                           test->status_before : verify_status, cpu_pin);
     }
     free(verify_status);
 
-    get_perf(names, ids, NUM_EVENTS, group_fd);
-    for (int i = 0; i < NUM_EVENTS; i++) {
-        close(fds[i]);
+    if (pp) {
+        int err = perf_set_read(pp, counts);
+        if (err)
+            fprintf(stderr, "perf_set_read: %s\n", strerror(-err));
+        else
+            perf_print_counts(stdout, perf.names, counts, events->nr);
     }
-    
-    return 0;
+    ret = 0;
+out:
+    if (sp)
+        perf_sampler_close(sp);
+    if (pp)
+        perf_set_close(pp);
+    free(counts);
+    return ret;
 }
 
 // Calculate and print timing results
-void print_timing_results(struct migration_test *test) {
+void print_timing_results(struct migration_test *test, const struct run_config *cfg) {
     long seconds = test->end_time.tv_sec - test->start_time.tv_sec;
     long nanoseconds = test->end_time.tv_nsec - test->start_time.tv_nsec;
     
@@ -348,8 +731,13 @@ void print_timing_results(struct migration_test *test) {
     printf("Total pages migrated: %d\n", test->num_pages);
     printf("Total size: %zu bytes (%.2f MB)\n", test->total_size, test->total_size / (1024.0 * 1024.0));
     printf("Total time: %.2f microseconds\n", total_time_us);
-    printf("Time per page: %.2f microseconds\n", time_per_page_us);
-    printf("Bandwidth: %.2f MB/s\n", bandwidth_mbps);
+    if (cfg->engine == ENGINE_MIGRATE_PAGES) {
+        // the time covers every page of the process, not just the test's
+        printf("Time per page: n/a, migrate_pages moved the whole process\n");
+    } else {
+        printf("Time per page: %.2f microseconds\n", time_per_page_us);
+        printf("Bandwidth: %.2f MB/s\n", bandwidth_mbps);
+    }
     printf("Raw timing: %ld.%09ld -> %ld.%09ld seconds\n", 
            test->start_time.tv_sec, test->start_time.tv_nsec,
            test->end_time.tv_sec, test->end_time.tv_nsec);
@@ -366,23 +754,167 @@ void cleanup_test(struct migration_test *test) {
     }
 }
 
+static void usage(const char *prog) {
+    const struct migrate_policy default_policy = MIGRATE_POLICY_DEFAULT;
+    fprintf(stderr,
+            "Usage: %s [-e event,...] [-a | -C cpu] [-s] [-E event] [-P period]\n"
+            "          [-r retries] [-b backoff_us] [-B batch] [-o sweep.csv] [-l]\n"
+            "          [-m engine] [-H] [-T threads] [-y] [-q]\n"
+            "          [num_pages [source_node [target_node [cpu_pin]]]]\n"
+            "  -e  events to count, perf syntax, or none (default: " DEFAULT_EVENTS ")\n"
+            "  -a  count system-wide instead of for this process\n"
+            "  -C  count every task on one CPU (needed for uncore events)\n"
+            "  -s  sample load addresses while touching the migrated pages; page faults\n"
+            "      when the PMU has none of " DEFAULT_SAMPLE_EVENTS "\n"
+            "  -E  event to sample, no fallback (implies -s)\n"
+            "  -P  sample period (default: %d)\n"
+            "  -r  retry rounds for pages that fail with EBUSY/EAGAIN/ENOMEM (default: %d)\n"
+            "  -b  backoff before the first retry in us, doubled each round (default: %u)\n"
+            "  -B  pages per move_pages call (default: all)\n"
+            "  -o  append the run's move_pages cost to a CSV, for cost_model fit\n"
+            "  -m  move_pages, mbind or migrate_pages (whole process, one thread) (default: move_pages)\n"
+            "  -H  back the pages with 2 MB THPs; num_pages counts THPs\n"
+            "  -T  threads, each moving its own slice on its own CPU from cpu_pin (default: 1)\n"
+            "  -y  do not wait for Enter before and after the migration\n"
+            "  -q  do not list the location of every page\n"
+            "  -l  list the events available on this host\n", prog, DEFAULT_SAMPLE_PERIOD,
+            default_policy.max_retries, default_policy.backoff_us);
+}
+
+/*
+ * Resolve the first memory-load event of @candidates this host can sample;
+ * leaves @list empty when none resolves, which selects page-fault sampling.
+ */
+static const struct perf_event_spec *resolve_sample_event(struct perf_event_list *list, const char *candidates) {
+    char copy[256];
+    char *save;
+    snprintf(copy, sizeof(copy), "%s", candidates);
+    for (char *name = strtok_r(copy, ";", &save); name; name = strtok_r(NULL, ";", &save)) {
+        if (perf_event_resolve(list, name, 0) == 0)
+            return &list->specs[list->nr - 1];
+    }
+    return NULL;
+}
+
 int main(int argc, char *argv[]) {
 
     int num_pages = 5;
     int source_node = 1;
     int target_node = 0;
     int cpu_pin = 0;
-    
-    // Parse command line arguments
-    if (argc >= 2) num_pages = atoi(argv[1]);
-    if (argc >= 3) source_node = atoi(argv[2]);
-    if (argc >= 4) target_node = atoi(argv[3]);
-    if (argc >= 5) cpu_pin = atoi(argv[4]);
+    const char *event_str = DEFAULT_EVENTS;
+    const char *sample_str = DEFAULT_SAMPLE_EVENTS;
+    struct run_config cfg = {
+        .scope = PERF_SCOPE_THREAD,
+        .cpu = -1,
+        .sample_period = DEFAULT_SAMPLE_PERIOD,
+        .sample_pages = 512,
+        .policy = MIGRATE_POLICY_DEFAULT,
+        .threads = 1,
+    };
+    int huge = 0, interactive = 1, ret = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "e:aC:sE:P:r:b:B:o:m:HT:yqlh")) != -1) {
+        switch (opt) {
+        case 'e':
+            event_str = optarg;
+            break;
+        case 'a':
+            cfg.scope = PERF_SCOPE_SYSTEM;
+            break;
+        case 'C':
+            cfg.scope = PERF_SCOPE_CPU;
+            cfg.cpu = atoi(optarg);
+            break;
+        case 'E':
+            sample_str = optarg;
+            cfg.sample_strict = 1;
+            /* fall through */
+        case 's':
+            cfg.sample = 1;
+            break;
+        case 'P':
+            cfg.sample_period = strtoull(optarg, NULL, 0);
+            break;
+        case 'r':
+            cfg.policy.max_retries = atoi(optarg);
+            break;
+        case 'b':
+            cfg.policy.backoff_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'B':
+            cfg.policy.batch = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            cfg.csv = optarg;
+            break;
+        case 'm':
+            for (cfg.engine = 0; cfg.engine < ENGINE_NR; cfg.engine++) {
+                if (!strcmp(optarg, engine_names[cfg.engine]))
+                    break;
+            }
+            if (cfg.engine == ENGINE_NR) {
+                fprintf(stderr, "Unknown engine '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'H':
+            huge = 1;
+            break;
+        case 'T':
+            cfg.threads = atoi(optarg);
+            break;
+        case 'y':
+            interactive = 0;
+            break;
+        case 'q':
+            cfg.quiet = 1;
+            break;
+        case 'l':
+            perf_list_events(stdout);
+            return 0;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // Parse positional arguments
+    if (optind < argc) num_pages = atoi(argv[optind++]);
+    if (optind < argc) source_node = atoi(argv[optind++]);
+    if (optind < argc) target_node = atoi(argv[optind++]);
+    if (optind < argc) cpu_pin = atoi(argv[optind++]);
+
+    struct perf_event_list events = {0};
+    int err = strcmp(event_str, "none") ? perf_event_list_parse(&events, event_str) : 0;
+    if (err) {
+        fprintf(stderr, "Cannot resolve event '%s': %s\n", events.error, strerror(-err));
+        perf_event_list_free(&events);
+        return 1;
+    }
+    cfg.events = &events;
+
+    struct perf_event_list sample_events = {0};
+    if (cfg.sample)
+        cfg.sample_event = resolve_sample_event(&sample_events, sample_str);
+    // only the built-in list may fall back to page faults
+    if (cfg.sample_strict && !cfg.sample_event) {
+        fprintf(stderr, "-E %s: no such event on this host\n", sample_str);
+        perf_event_list_free(&events);
+        return 1;
+    }
     
     printf("=== Deterministic Page Migration Test ===\n");
     printf("PID: %d\n", getpid());
     printf("Pages: %d, Source Node: %d, Target Node: %d, CPU Pin: %d\n", 
            num_pages, source_node, target_node, cpu_pin);
+    if (num_pages < 1 || cfg.threads < 1) {
+        printf("num_pages and threads must be positive\n");
+        return 1;
+    }
+    if (cfg.threads > num_pages)
+        cfg.threads = num_pages;
     
     if (numa_available() < 0) {
         printf("NUMA not available\n");
@@ -398,24 +930,31 @@ int main(int argc, char *argv[]) {
     pin_to_cpu(cpu_pin);
     
     // Initialize test
-    struct migration_test *test = init_migration_test(num_pages, source_node, target_node);
+    struct migration_test *test = init_migration_test(num_pages, source_node, target_node, huge);
     if (!test) {
         printf("Failed to initialize migration test\n");
         return 1;
     }
     
     // Wait for user input to ensure clean measurement
-    printf("\nPress Enter to start migration (this allows you to start tracing tools)...");
-    getchar();
+    if (interactive) {
+        printf("\nPress Enter to start migration (this allows you to start tracing tools)...");
+        getchar();
+    }
     
     // Perform migration
-    if (perform_migration(test) == 0) {
-        print_timing_results(test);
+    if (perform_migration(test, &cfg, cpu_pin) == 0) {
+        print_timing_results(test, &cfg);
+        ret = 0;
     }
     
-    printf("\nPress Enter to exit (allows you to collect final traces)...");
-    getchar();
+    if (interactive) {
+        printf("\nPress Enter to exit (allows you to collect final traces)...");
+        getchar();
+    }
     
     cleanup_test(test);
-    return 0;
+    perf_event_list_free(&sample_events);
+    perf_event_list_free(&events);
+    return ret;
 }
\ No newline at end of file
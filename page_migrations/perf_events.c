@@ -1,41 +1,70 @@
 #include "perf_events.h"
+#include <errno.h>
 
-void reset_and_enable_ioctl(int fd){
-    int err = ioctl(fd, PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
-    if (err){
-        perror("reset_and_enable_ioctl");
-        exit(EXIT_FAILURE);
-    }
-    err = ioctl(fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
-    if (err){
-        perror("reset_and_enable_ioctl");
-        exit(EXIT_FAILURE);
-    }
+#define PERF_READ_FORMAT (PERF_FORMAT_GROUP | PERF_FORMAT_ID | \
+                          PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING)
+
+uint64_t config_cache_id(uint64_t perf_hw_cache_id, uint64_t perf_hw_cache_op_id, uint64_t perf_hw_cache_op_result_id){
+    return (perf_hw_cache_id) |
+    (perf_hw_cache_op_id << 8) |
+    (perf_hw_cache_op_result_id << 16);
 }
 
-void disable_ioctl(int fd){
-    int err = ioctl(fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
-    if (err){
-        perror("reset_and_enable_ioctl");
-        exit(EXIT_FAILURE);
+static uint64_t scale_count(uint64_t raw, uint64_t enabled, uint64_t running){
+    if (running == 0)
+        return 0;
+    if (running >= enabled)
+        return raw;
+    return (uint64_t)((double)raw * enabled / running);
+}
+
+/*
+ * perf_online_cpus - Parse /sys/devices/system/cpu/online ("0-3,8,10-11")
+ * into @cpus. Returns the number of CPUs found or -errno.
+ */
+int perf_online_cpus(int *cpus, int max){
+    char line[4096];
+    FILE *f = fopen("/sys/devices/system/cpu/online", "r");
+    if (!f)
+        return -errno;
+    if (!fgets(line, sizeof(line), f)) {
+        fclose(f);
+        return -EIO;
     }
+    fclose(f);
+
+    int n = 0;
+    char *p = line;
+    while (*p && *p != '\n') {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (end == p)
+            return -EINVAL;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        for (long c = lo; c <= hi; c++) {
+            if (n == max)
+                return -ENOSPC;
+            cpus[n++] = (int)c;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return n;
 }
 
-void config_perf(struct perf_event_attr *pe,int *fd,uint64_t type, uint64_t config){
-    // memset(pe, 0, sizeof(*pe));
-    pe->type = type;
+static void fill_attr(struct perf_event_attr *pe, const struct perf_event_spec *spec){
+    memset(pe, 0, sizeof(*pe));
     pe->size = sizeof(*pe);
-    pe->config = config;
+    pe->type = spec->type;
+    pe->config = spec->config;
+    pe->config1 = spec->config1;  // kprobe_func for kprobe PMU events
+    pe->config2 = spec->config2;  // probe_offset for kprobe PMU events
     pe->disabled = 1;
-    pe->exclude_kernel = 0;
+    pe->exclude_kernel = !!(spec->flags & PERF_SPEC_EXCLUDE_KERNEL);
+    pe->exclude_user = !!(spec->flags & PERF_SPEC_EXCLUDE_USER);
     pe->exclude_hv = 1;
-    *fd = syscall(__NR_perf_event_open, pe, 0, -1, -1, 0);
-}
-
-uint64_t config_cache_id(uint64_t perf_hw_cache_id, uint64_t perf_hw_cache_op_id, uint64_t perf_hw_cache_op_result_id){
-    return (perf_hw_cache_id) | 
-    (perf_hw_cache_op_id << 8) | 
-    (perf_hw_cache_op_result_id << 16);
+    pe->read_format = PERF_READ_FORMAT;
 }
 
 /*
@@ -52,90 +81,312 @@ This means that the values of the member events can be
 meaningfully compared—added, divided (to get ratios), and so on—
 with each other, since they have counted events for the same set
 of executed instructions.
-
-Inputs:
-struct perf_event_attr pe;
-int fds[NUM_EVENTS];       // Array for file descriptors
-uint64_t ids[NUM_EVENTS];  // Array for IDs
-uint64_t types[NUM_EVENTS];
-uint64_t configs[NUM_EVENTS];
 */
-// The new, more flexible config_perf_multi function
-int config_perf_multi(struct perf_event_attr *pe, int *fds, uint64_t *ids,
-    uint64_t *types, uint64_t *configs,
-    int kprobe_pmu, // Pass in the kprobe PMU type
-    int event_count) {
-    int group_fd = -1;
-
-    for (int i = 0; i < event_count; i++) {
-        memset(pe, 0, sizeof(struct perf_event_attr));
-        pe->size = sizeof(struct perf_event_attr);
-        pe->type = types[i];
-        pe->disabled = 1;
-        pe->exclude_kernel = 1;
-        pe->exclude_hv = 1;
-        pe->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
-
-    // --- THIS IS THE NEW LOGIC ---
-    // Check if the current event is a kprobe
-        if (pe->type == kprobe_pmu) {
-            // For a kprobe, the 'config' array element holds the string pointer
-            pe->kprobe_func = configs[i]; // This is a (uint64_t)char*
-            pe->probe_offset = 0;         // Probe the function entry
-            } else {
-            // For all other event types, 'config' is the event ID
-            pe->config = configs[i];
-        }
-        // --- END OF NEW LOGIC ---
-    
-        // The rest of the function is the same as your corrected version
-        int current_fd = syscall(__NR_perf_event_open, pe, 0, -1, group_fd, 0);
-        if (current_fd < 0) {
-            fprintf(stderr, "Error opening event #%d (type: %lu, config: %lx): ", i, types[i], configs[i]);
-            perror("perf_event_open");
-            exit(EXIT_FAILURE);
+/**
+ * perf_group_open - Open @n events as one group on (@pid, @cpu).
+ *
+ * The first spec becomes the group leader. On failure every fd opened so far
+ * is closed, g->nr_events is left at the index of the event that failed and
+ * -errno is returned.
+ */
+int perf_group_open(struct perf_group *g, const struct perf_event_spec *specs, int n, pid_t pid, int cpu){
+    struct perf_event_attr pe;
+
+    memset(g, 0, sizeof(*g));
+    for (int i = 0; i < PERF_MAX_GROUP_EVENTS; i++)
+        g->fds[i] = -1;
+    g->pid = pid;
+    g->cpu = cpu;
+    if (n <= 0 || n > PERF_MAX_GROUP_EVENTS)
+        return -EINVAL;
+
+    for (int i = 0; i < n; i++) {
+        fill_attr(&pe, &specs[i]);
+        int group_fd = i ? g->fds[0] : -1;
+        int fd = syscall(__NR_perf_event_open, &pe, pid, cpu, group_fd, 0);
+        if (fd < 0 || ioctl(fd, PERF_EVENT_IOC_ID, &g->ids[i]) < 0) {
+            int err = -errno;
+            if (fd >= 0)
+                close(fd);
+            perf_group_close(g);
+            g->nr_events = i;
+            return err;
         }
-    
-        fds[i] = current_fd;
-        if (i == 0) {
-        group_fd = current_fd;
+        g->fds[i] = fd;
+        g->nr_events = i + 1;
+    }
+    g->buf_size = (3 + 2 * n) * sizeof(uint64_t);
+    return 0;
+}
+
+void perf_group_close(struct perf_group *g){
+    for (int i = g->nr_events - 1; i >= 0; i--) {
+        if (g->fds[i] >= 0)
+            close(g->fds[i]);
+        g->fds[i] = -1;
+    }
+}
+
+static int group_ioctl(struct perf_group *g, unsigned long req){
+    if (ioctl(g->fds[0], req, PERF_IOC_FLAG_GROUP) < 0)
+        return -errno;
+    return 0;
+}
+
+int perf_group_reset(struct perf_group *g){
+    return group_ioctl(g, PERF_EVENT_IOC_RESET);
+}
+
+int perf_group_enable(struct perf_group *g){
+    return group_ioctl(g, PERF_EVENT_IOC_ENABLE);
+}
+
+int perf_group_disable(struct perf_group *g){
+    return group_ioctl(g, PERF_EVENT_IOC_DISABLE);
+}
+
+/**
+ * perf_group_read - Read all counters of @g into @counts[0..nr_events).
+ *
+ * The group does not need to be disabled first; reading a running group is
+ * a single read(2) into the preallocated buffer. The kernel reports members
+ * in creation order, so the ids are only searched when that does not hold.
+ */
+int perf_group_read(struct perf_group *g, struct perf_count *counts){
+    ssize_t len = read(g->fds[0], g->buf, g->buf_size);
+    if (len < 0)
+        return -errno;
+    if ((size_t)len < 3 * sizeof(uint64_t))
+        return -EIO;
+
+    uint64_t nr = g->buf[0];
+    uint64_t enabled = g->buf[1];
+    uint64_t running = g->buf[2];
+    const uint64_t *vals = &g->buf[3];
+    if (nr > (uint64_t)g->nr_events)
+        return -EIO;
+
+    for (int i = 0; i < g->nr_events; i++) {
+        uint64_t raw = 0;
+        if ((uint64_t)i < nr && vals[2 * i + 1] == g->ids[i]) {
+            raw = vals[2 * i];
+        } else {
+            for (uint64_t j = 0; j < nr; j++) {
+                if (vals[2 * j + 1] == g->ids[i]) {
+                    raw = vals[2 * j];
+                    break;
+                }
+            }
         }
-        ioctl(current_fd, PERF_EVENT_IOC_ID, &ids[i]);
+        counts[i].raw = raw;
+        counts[i].time_enabled = enabled;
+        counts[i].time_running = running;
+        counts[i].value = scale_count(raw, enabled, running);
     }
-    return group_fd;
-}
-// CORRECTED: Buffer size calculation, struct definition, and print loop were fixed.
-void get_perf(char **string, uint64_t *ids, int event_count, int group_fd) {
-    // Disable the group before reading
-    disable_ioctl(group_fd);
-
-    // Calculate buffer size needed for the read
-    size_t buffer_size = sizeof(uint64_t) + (event_count * sizeof(uint64_t) * 2);
-    char *buf = malloc(buffer_size);
-    if (!buf) {
-        perror("malloc");
-        exit(EXIT_FAILURE);
+    return 0;
+}
+
+/**
+ * perf_set_open - Open @specs in the given @scope.
+ *
+ * Events are split into groups at every spec carrying PERF_SPEC_NEW_GROUP and
+ * whenever a group reaches PERF_MAX_GROUP_EVENTS. Groups are multiplexed
+ * independently, so events that cannot share the PMU should be put in
+ * separate groups. @pid is used for PERF_SCOPE_THREAD and @cpu for
+ * PERF_SCOPE_CPU; PERF_SCOPE_SYSTEM opens every group on every online CPU.
+ * Uncore events cannot be counted per task and fail with -EINVAL in
+ * PERF_SCOPE_THREAD; count them on a CPU from the PMU's cpumask instead.
+ */
+int perf_set_open(struct perf_set *set, const struct perf_event_spec *specs, int n,
+                  enum perf_scope scope, pid_t pid, int cpu){
+    int err = -ENOMEM;
+
+    memset(set, 0, sizeof(*set));
+    set->scope = scope;
+    set->failed_idx = -1;
+    if (n <= 0)
+        return -EINVAL;
+
+    set->names = calloc(n, sizeof(*set->names));
+    set->group_first = calloc(n, sizeof(*set->group_first));
+    set->scratch = calloc(n, sizeof(*set->scratch));
+    if (!set->names || !set->group_first || !set->scratch)
+        goto fail;
+
+    for (int i = 0; i < n; i++) {
+        if (scope == PERF_SCOPE_THREAD && (specs[i].flags & PERF_SPEC_UNCORE)) {
+            set->failed_idx = i;
+            err = -EINVAL;
+            goto fail;
+        }
+        set->names[i] = specs[i].name;
+        if (i == 0 || (specs[i].flags & PERF_SPEC_NEW_GROUP) ||
+            i - set->group_first[set->nr_groups - 1] == PERF_MAX_GROUP_EVENTS)
+            set->group_first[set->nr_groups++] = i;
     }
+    set->nr_events = n;
 
-    if (read(group_fd, buf, buffer_size) < 0) {
-        perror("read");
-        free(buf);
-        exit(EXIT_FAILURE);
+    switch (scope) {
+    case PERF_SCOPE_THREAD:
+    case PERF_SCOPE_CPU:
+        set->cpus = malloc(sizeof(*set->cpus));
+        if (!set->cpus)
+            goto fail;
+        set->cpus[0] = scope == PERF_SCOPE_CPU ? cpu : -1;
+        set->nr_cpus = 1;
+        break;
+    case PERF_SCOPE_SYSTEM: {
+        long max = sysconf(_SC_NPROCESSORS_CONF);
+        if (max <= 0)
+            max = 1;
+        set->cpus = calloc(max, sizeof(*set->cpus));
+        if (!set->cpus)
+            goto fail;
+        set->nr_cpus = perf_online_cpus(set->cpus, (int)max);
+        if (set->nr_cpus < 0) {
+            err = set->nr_cpus;
+            set->nr_cpus = 0;
+            goto fail;
+        }
+        break;
+    }
+    default:
+        err = -EINVAL;
+        goto fail;
     }
 
-    struct read_format *rf = (struct read_format *)buf;
+    set->groups = calloc((size_t)set->nr_cpus * set->nr_groups, sizeof(*set->groups));
+    if (!set->groups)
+        goto fail;
 
-    printf("\n--- Perf Statistics ---\n");
-    // Match the read values back to their names using the IDs
-    for (size_t i = 0; i < rf->nr; i++) {
-        for (int j = 0; j < event_count; j++) {
-            if (rf->values[i].id == ids[j]) {
-                // CORRECTED: Use %llu for uint64_t and correct string array index
-                printf("%-25s: %lu\n", string[j], rf->values[i].value);
-                break; // Found it, move to the next value
+    pid_t task = scope == PERF_SCOPE_THREAD ? pid : -1;
+    for (int c = 0; c < set->nr_cpus; c++) {
+        for (int gi = 0; gi < set->nr_groups; gi++) {
+            int first = set->group_first[gi];
+            int last = gi + 1 < set->nr_groups ? set->group_first[gi + 1] : n;
+            struct perf_group *g = &set->groups[c * set->nr_groups + gi];
+            err = perf_group_open(g, &specs[first], last - first, task, set->cpus[c]);
+            if (err) {
+                set->failed_idx = first + g->nr_events;
+                goto fail;
             }
         }
     }
-    printf("-----------------------\n");
-    free(buf);
-}
\ No newline at end of file
+    return 0;
+
+fail:
+    perf_set_close(set);
+    return err;
+}
+
+void perf_set_close(struct perf_set *set){
+    if (set->groups) {
+        for (int i = 0; i < set->nr_cpus * set->nr_groups; i++)
+            perf_group_close(&set->groups[i]);
+    }
+    free(set->groups);
+    free(set->cpus);
+    free(set->scratch);
+    free(set->group_first);
+    free(set->names);
+    set->groups = NULL;
+    set->cpus = NULL;
+    set->scratch = NULL;
+    set->group_first = NULL;
+    set->names = NULL;
+}
+
+static int set_for_each(struct perf_set *set, int (*fn)(struct perf_group *)){
+    for (int i = 0; i < set->nr_cpus * set->nr_groups; i++) {
+        int err = fn(&set->groups[i]);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+int perf_set_reset(struct perf_set *set){
+    return set_for_each(set, perf_group_reset);
+}
+
+int perf_set_enable(struct perf_set *set){
+    return set_for_each(set, perf_group_enable);
+}
+
+int perf_set_disable(struct perf_set *set){
+    return set_for_each(set, perf_group_disable);
+}
+
+/**
+ * perf_set_read_cpu - Read the counters of one CPU instance of @set.
+ * @cpu_idx: index into set->cpus, not a CPU number.
+ */
+int perf_set_read_cpu(struct perf_set *set, int cpu_idx, struct perf_count *counts){
+    if (cpu_idx < 0 || cpu_idx >= set->nr_cpus)
+        return -EINVAL;
+    for (int gi = 0; gi < set->nr_groups; gi++) {
+        struct perf_group *g = &set->groups[cpu_idx * set->nr_groups + gi];
+        int err = perf_group_read(g, &counts[set->group_first[gi]]);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+/**
+ * perf_set_read - Read every counter of @set, summed over all CPUs.
+ *
+ * Each CPU instance is scaled on its own before being added, so the times in
+ * the result are the sums of the per-CPU enabled/running times.
+ */
+int perf_set_read(struct perf_set *set, struct perf_count *counts){
+    if (set->nr_cpus == 1)
+        return perf_set_read_cpu(set, 0, counts);
+
+    memset(counts, 0, set->nr_events * sizeof(*counts));
+    for (int c = 0; c < set->nr_cpus; c++) {
+        int err = perf_set_read_cpu(set, c, set->scratch);
+        if (err)
+            return err;
+        for (int i = 0; i < set->nr_events; i++) {
+            counts[i].raw += set->scratch[i].raw;
+            counts[i].time_enabled += set->scratch[i].time_enabled;
+            counts[i].time_running += set->scratch[i].time_running;
+            counts[i].value += set->scratch[i].value;
+        }
+    }
+    return 0;
+}
+
+/**
+ * perf_count_delta - Difference between two reads of the same counters.
+ *
+ * Lets a measurement loop bracket a region with two reads instead of a
+ * reset/enable/disable ioctl sequence. The delta is rescaled with the
+ * enabled/running time that elapsed between the two reads.
+ */
+void perf_count_delta(const struct perf_count *end, const struct perf_count *start,
+                      struct perf_count *delta, int n){
+    for (int i = 0; i < n; i++) {
+        delta[i].raw = end[i].raw - start[i].raw;
+        delta[i].time_enabled = end[i].time_enabled - start[i].time_enabled;
+        delta[i].time_running = end[i].time_running - start[i].time_running;
+        delta[i].value = scale_count(delta[i].raw, delta[i].time_enabled, delta[i].time_running);
+    }
+}
+
+void perf_print_counts(FILE *out, const char *const *names, const struct perf_count *counts, int n){
+    fprintf(out, "\n--- Perf Statistics ---\n");
+    for (int i = 0; i < n; i++) {
+        const struct perf_count *c = &counts[i];
+        if (c->time_running == 0) {
+            fprintf(out, "%-35s: %20s\n", names[i], "<not counted>");
+        } else if (c->time_running < c->time_enabled) {
+            fprintf(out, "%-35s: %20lu  (scaled, %.1f%% running)\n", names[i], c->value,
+                    100.0 * c->time_running / c->time_enabled);
+        } else {
+            fprintf(out, "%-35s: %20lu\n", names[i], c->value);
+        }
+    }
+    fprintf(out, "-----------------------\n");
+}
@@ -1,6 +1,8 @@
 #ifndef PERF_EVENTS_TRACKER
 #define PERF_EVENTS_TRACKER
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE
+#endif
 /*for performance tracking*/
 #include <linux/perf_event.h>
 #include <asm/unistd.h>
@@ -12,32 +14,181 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-struct value {
-  unsigned long value;
-  unsigned long id;
+/*
+ * Counter library on top of perf_event_open(2).
+ *
+ * Nothing in here prints or exits: every call returns 0 (or a count) on
+ * success and -errno on failure. All buffers are sized at open time so that
+ * the enable/disable/read calls can be issued inside measurement loops
+ * without touching the allocator.
+ *
+ * Every group is opened with PERF_FORMAT_TOTAL_TIME_ENABLED/RUNNING, and the
+ * values returned by the read calls are scaled by enabled/running so that
+ * counters which were multiplexed off the PMU still give an estimate.
+ */
+
+#define PERF_MAX_GROUP_EVENTS 16
+
+/* Flags for struct perf_event_spec */
+#define PERF_SPEC_EXCLUDE_KERNEL (1u << 0)
+#define PERF_SPEC_EXCLUDE_USER   (1u << 1)
+#define PERF_SPEC_NEW_GROUP      (1u << 2)  // start a new group at this event
+#define PERF_SPEC_UNCORE         (1u << 3)  // PMU has a cpumask, cannot count per task
+
+/*
+ * One event to open. For kprobe PMU events config1 holds the (uint64_t)
+ * pointer to the function name and config2 the probe offset, matching the
+ * kprobe_func/probe_offset unions in struct perf_event_attr.
+ */
+struct perf_event_spec {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+  uint64_t config1;
+  uint64_t config2;
+  uint32_t flags;
+};
+
+/* Value of one counter as returned by the read calls */
+struct perf_count {
+  uint64_t raw;           // value as read from the kernel
+  uint64_t time_enabled;
+  uint64_t time_running;
+  uint64_t value;         // raw scaled by time_enabled / time_running
 };
-struct read_format {
-  unsigned long nr;
-  struct value values[];
+
+/* A group of events bound to one (pid, cpu) pair */
+struct perf_group {
+  pid_t pid;
+  int cpu;
+  int nr_events;
+  int fds[PERF_MAX_GROUP_EVENTS];     // -1 when not open
+  uint64_t ids[PERF_MAX_GROUP_EVENTS];
+  size_t buf_size;
+  uint64_t buf[3 + 2 * PERF_MAX_GROUP_EVENTS];  // nr, enabled, running, {value, id}...
 };
 
 /*
-#ifdef RISCV64
-#define SINGLE_MASK 0x1
-#define MEMSYS_EVENTS 0x2
-#elif __aarch64__
-#define L1D_CACHE 0x04
-#define L1D_CACHE_REFILL 0x03
-#define L2D_CACHE 0x16
-#define L2D_CACHE_REFILL 0x17
-#define L3D_CACHE 0x2B
-#define L3D_CACHE_REFILL 0x2A
-#endif
-*/
+ * Events resolved from a perf-style list, e.g.
+ *   "cycles,{dTLB-loads:u,dTLB-load-misses:u},cpu/event=0xd0,umask=0x11/u,kprobe:handle_mm_fault"
+ * The list owns the names and kprobe function strings the specs point at.
+ */
+struct perf_event_list {
+  int nr;
+  int cap;
+  struct perf_event_spec *specs;
+  char **strings;
+  int nr_strings;
+  char error[128];  // token that failed to resolve
+};
+
+enum perf_scope {
+  PERF_SCOPE_THREAD,  // one task (pid, 0 = self) on any CPU
+  PERF_SCOPE_CPU,     // every task on one CPU
+  PERF_SCOPE_SYSTEM,  // every task on every online CPU
+};
+
+/*
+ * A list of events split into groups and instantiated once per CPU the
+ * scope covers. Counts are aggregated across CPUs by perf_set_read().
+ */
+struct perf_set {
+  enum perf_scope scope;
+  int nr_events;
+  int nr_groups;
+  int nr_cpus;
+  int failed_idx;             // event index that failed to open, or -1
+  const char **names;         // [nr_events]
+  int *group_first;           // [nr_groups] index of the first event of each group
+  int *cpus;                  // [nr_cpus]
+  struct perf_group *groups;  // [nr_cpus * nr_groups], CPU-major
+  struct perf_count *scratch; // [nr_events]
+};
+
+/*
+ * Sampling of data addresses through the perf ring buffer. Memory-load
+ * events are opened precise with PERF_SAMPLE_ADDR/PHYS_ADDR/DATA_SRC/WEIGHT;
+ * when the PMU cannot do that the sampler steps down to non-precise PMU
+ * sampling and finally to the page-faults software event, which only
+ * reports the faulting address.
+ */
+enum perf_sample_mode {
+  PERF_SAMPLE_MODE_PRECISE,   // precise_ip > 0, data source and weight valid
+  PERF_SAMPLE_MODE_PMU,       // PMU sampling without skid control or data source
+  PERF_SAMPLE_MODE_SOFTWARE,  // page-faults, addr only
+};
+
+/* Where a sampled load was served from, decoded from PERF_SAMPLE_DATA_SRC */
+enum perf_mem_source {
+  PERF_MEM_SRC_NA,
+  PERF_MEM_SRC_CACHE,         // L1/LFB/L2/L3 of the local socket
+  PERF_MEM_SRC_LOCAL_RAM,
+  PERF_MEM_SRC_REMOTE_CACHE,
+  PERF_MEM_SRC_REMOTE_RAM,
+  PERF_MEM_SRC_OTHER,         // I/O, uncached, PMEM, CXL
+  PERF_MEM_SRC_MAX,
+};
+
+struct perf_sample {
+  uint64_t ip;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t addr;
+  uint64_t weight;     // load latency in cycles, 0 if not available
+  uint64_t data_src;
+  uint64_t phys_addr;  // 0 if not available
+};
+
+struct perf_sampler {
+  int fd;
+  enum perf_sample_mode mode;
+  int precise_ip;
+  uint64_t period;
+  uint64_t sample_type;
+  void *base;                          // mmap'd metadata page + data pages
+  size_t mmap_size;
+  uint64_t data_size;
+  struct perf_event_mmap_page *meta;
+  uint64_t lost;                       // from PERF_RECORD_LOST
+  uint64_t bounce[64];                 // records that wrap the ring end
+};
+
+typedef int (*perf_sample_fn)(const struct perf_sample *sample, void *ctx);
+
 uint64_t config_cache_id(uint64_t perf_hw_cache_id, uint64_t perf_hw_cache_op_id, uint64_t perf_hw_cache_op_result_id);
-void reset_and_enable_ioctl(int fd);
-void disable_ioctl(int fd);
-void config_perf(struct perf_event_attr *pe,int *fd,uint64_t type, uint64_t config);
-int config_perf_multi(struct perf_event_attr *pe, int *fds, uint64_t *ids, uint64_t *types, uint64_t *configs, int kprobe_pmu, int event_count);
-void get_perf(char **string, uint64_t *ids, int event_count, int group_fd);
-#endif
\ No newline at end of file
+int perf_online_cpus(int *cpus, int max);
+int perf_pmu_type(const char *pmu);
+
+int perf_event_resolve(struct perf_event_list *list, const char *name, uint32_t flags);
+int perf_event_list_parse(struct perf_event_list *list, const char *str);
+void perf_event_list_free(struct perf_event_list *list);
+void perf_list_events(FILE *out);
+
+int perf_group_open(struct perf_group *g, const struct perf_event_spec *specs, int n, pid_t pid, int cpu);
+void perf_group_close(struct perf_group *g);
+int perf_group_reset(struct perf_group *g);
+int perf_group_enable(struct perf_group *g);
+int perf_group_disable(struct perf_group *g);
+int perf_group_read(struct perf_group *g, struct perf_count *counts);
+
+int perf_set_open(struct perf_set *set, const struct perf_event_spec *specs, int n, enum perf_scope scope, pid_t pid, int cpu);
+void perf_set_close(struct perf_set *set);
+int perf_set_reset(struct perf_set *set);
+int perf_set_enable(struct perf_set *set);
+int perf_set_disable(struct perf_set *set);
+int perf_set_read(struct perf_set *set, struct perf_count *counts);
+int perf_set_read_cpu(struct perf_set *set, int cpu_idx, struct perf_count *counts);
+
+int perf_sampler_open(struct perf_sampler *s, const struct perf_event_spec *spec, uint64_t period,
+                      pid_t pid, int cpu, unsigned data_pages);
+void perf_sampler_close(struct perf_sampler *s);
+int perf_sampler_enable(struct perf_sampler *s);
+int perf_sampler_disable(struct perf_sampler *s);
+int perf_sampler_consume(struct perf_sampler *s, perf_sample_fn fn, void *ctx);
+enum perf_mem_source perf_mem_classify(uint64_t data_src);
+const char *perf_mem_source_name(enum perf_mem_source src);
+const char *perf_sample_mode_name(enum perf_sample_mode mode);
+
+void perf_count_delta(const struct perf_count *end, const struct perf_count *start, struct perf_count *delta, int n);
+void perf_print_counts(FILE *out, const char *const *names, const struct perf_count *counts, int n);
+#endif
@@ -0,0 +1,576 @@
+#include "perf_events.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+
+/*
+ * Symbolic event resolution, following the syntax of perf-list(1):
+ *
+ *   cycles, page-faults, dTLB-load-misses    generic hardware/software/cache events
+ *   rd011                                    raw PMU config
+ *   cpu/event=0xd0,umask=0x11/               PMU event from sysfs format/ terms
+ *   mem-loads, uncore_imc_0/cas_count_read/  PMU event from sysfs events/ aliases
+ *   kprobe:func[+off], kretprobe:func        kprobe PMU
+ *   migrate:mm_migrate_pages                 tracepoint
+ *
+ * An event may be followed by ":u" or ":k" (or "/u" after a PMU term list)
+ * to count only user or only kernel mode.
+ */
+
+#define PMU_SYSFS "/sys/bus/event_source/devices"
+
+struct generic_event {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static const struct generic_event generic_events[] = {
+    { "cycles",                  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "cpu-cycles",              PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",            PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache-references",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+    { "cache-misses",            PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branch-instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { "branches",                PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { "branch-misses",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "bus-cycles",              PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES },
+    { "stalled-cycles-frontend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+    { "stalled-cycles-backend",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+    { "ref-cycles",              PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES },
+    { "cpu-clock",               PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK },
+    { "task-clock",              PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "page-faults",             PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    { "faults",                  PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    { "minor-faults",            PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN },
+    { "major-faults",            PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ },
+    { "context-switches",        PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { "cs",                      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { "cpu-migrations",          PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+    { "migrations",              PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+    { "alignment-faults",        PERF_TYPE_SOFTWARE, PERF_COUNT_SW_ALIGNMENT_FAULTS },
+    { "emulation-faults",        PERF_TYPE_SOFTWARE, PERF_COUNT_SW_EMULATION_FAULTS },
+    { "dummy",                   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_DUMMY },
+};
+
+static const char *const cache_names[PERF_COUNT_HW_CACHE_MAX] = {
+    [PERF_COUNT_HW_CACHE_L1D]  = "L1-dcache",
+    [PERF_COUNT_HW_CACHE_L1I]  = "L1-icache",
+    [PERF_COUNT_HW_CACHE_LL]   = "LLC",
+    [PERF_COUNT_HW_CACHE_DTLB] = "dTLB",
+    [PERF_COUNT_HW_CACHE_ITLB] = "iTLB",
+    [PERF_COUNT_HW_CACHE_BPU]  = "branch",
+    [PERF_COUNT_HW_CACHE_NODE] = "node",
+};
+
+static const char *const cache_ops[PERF_COUNT_HW_CACHE_OP_MAX] = {
+    [PERF_COUNT_HW_CACHE_OP_READ]     = "load",
+    [PERF_COUNT_HW_CACHE_OP_WRITE]    = "store",
+    [PERF_COUNT_HW_CACHE_OP_PREFETCH] = "prefetch",
+};
+
+static int read_sysfs(const char *path, char *buf, size_t len){
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -errno;
+    if (!fgets(buf, len, f)) {
+        fclose(f);
+        return -EIO;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static int pmu_file(const char *pmu, const char *dir, const char *name, char *buf, size_t len){
+    char path[PATH_MAX];
+    if (dir)
+        snprintf(path, sizeof(path), PMU_SYSFS "/%s/%s/%s", pmu, dir, name);
+    else
+        snprintf(path, sizeof(path), PMU_SYSFS "/%s/%s", pmu, name);
+    return read_sysfs(path, buf, len);
+}
+
+/**
+ * perf_pmu_type - PMU type number for perf_event_attr.type, or -errno.
+ */
+int perf_pmu_type(const char *pmu){
+    char buf[32];
+    int err = pmu_file(pmu, NULL, "type", buf, sizeof(buf));
+    if (err)
+        return err;
+    return atoi(buf);
+}
+
+static int pmu_is_uncore(const char *pmu){
+    char buf[512];
+    return pmu_file(pmu, NULL, "cpumask", buf, sizeof(buf)) == 0;
+}
+
+static char *list_strdup(struct perf_event_list *list, const char *s, size_t len){
+    char **strings = realloc(list->strings, (list->nr_strings + 1) * sizeof(*strings));
+    if (!strings)
+        return NULL;
+    list->strings = strings;
+    char *copy = strndup(s, len);
+    if (copy)
+        list->strings[list->nr_strings++] = copy;
+    return copy;
+}
+
+static int list_push(struct perf_event_list *list, const struct perf_event_spec *spec){
+    if (list->nr == list->cap) {
+        int cap = list->cap ? 2 * list->cap : 8;
+        struct perf_event_spec *specs = realloc(list->specs, cap * sizeof(*specs));
+        if (!specs)
+            return -ENOMEM;
+        list->specs = specs;
+        list->cap = cap;
+    }
+    list->specs[list->nr++] = *spec;
+    return 0;
+}
+
+/*
+ * Deposit @value into the bit ranges of a sysfs format descriptor such as
+ * "config:0-7", "config1:0-15" or "config:0-7,32-35".
+ */
+static int apply_format(struct perf_event_spec *spec, const char *fmt, uint64_t value){
+    uint64_t *target;
+    const char *p;
+
+    if (!strncmp(fmt, "config1:", 8)) {
+        target = &spec->config1;
+        p = fmt + 8;
+    } else if (!strncmp(fmt, "config2:", 8)) {
+        target = &spec->config2;
+        p = fmt + 8;
+    } else if (!strncmp(fmt, "config:", 7)) {
+        target = &spec->config;
+        p = fmt + 7;
+    } else {
+        return -EINVAL;
+    }
+
+    int k = 0;
+    while (*p) {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (end == p)
+            return -EINVAL;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        if (lo < 0 || hi > 63 || hi < lo)
+            return -EINVAL;
+        for (long b = lo; b <= hi; b++, k++) {
+            uint64_t bit = 1ULL << b;
+            if (k < 64 && (value >> k) & 1)
+                *target |= bit;
+            else
+                *target &= ~bit;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return 0;
+}
+
+/*
+ * Apply a comma separated term list ("event=0xd0,umask=0x11", "mem-loads")
+ * for @pmu to @spec. Bare terms are format flags or events/ aliases, which
+ * are expanded recursively.
+ */
+static int apply_terms(struct perf_event_list *list, struct perf_event_spec *spec,
+                       const char *pmu, const char *terms, int depth){
+    char buf[512];
+    char copy[512];
+    char *save;
+
+    if (depth > 4)
+        return -ELOOP;
+    snprintf(copy, sizeof(copy), "%s", terms);
+
+    for (char *term = strtok_r(copy, ",", &save); term; term = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(term, '=');
+        uint64_t value = 1;
+        if (eq) {
+            *eq = '\0';
+            char *end;
+            if (eq[1] == '?')
+                return -EINVAL;  // parameter must be supplied by the user
+            value = strtoull(eq + 1, &end, 0);
+            if (!strcmp(term, "name")) {
+                if (!(spec->name = list_strdup(list, eq + 1, strlen(eq + 1))))
+                    return -ENOMEM;
+                continue;
+            }
+            if (end == eq + 1 || *end)
+                return -EINVAL;
+        }
+
+        if (!strcmp(term, "config")) {
+            spec->config = value;
+        } else if (!strcmp(term, "config1")) {
+            spec->config1 = value;
+        } else if (!strcmp(term, "config2")) {
+            spec->config2 = value;
+        } else if (pmu_file(pmu, "format", term, buf, sizeof(buf)) == 0) {
+            int err = apply_format(spec, buf, value);
+            if (err)
+                return err;
+        } else if (!eq && pmu_file(pmu, "events", term, buf, sizeof(buf)) == 0) {
+            int err = apply_terms(list, spec, pmu, buf, depth + 1);
+            if (err)
+                return err;
+        } else {
+            return -ENOENT;
+        }
+    }
+    return 0;
+}
+
+static int resolve_pmu(struct perf_event_list *list, struct perf_event_spec *spec,
+                       const char *pmu, const char *terms){
+    int type = perf_pmu_type(pmu);
+    if (type < 0)
+        return type;
+    spec->type = type;
+    if (pmu_is_uncore(pmu))
+        spec->flags |= PERF_SPEC_UNCORE;
+    return apply_terms(list, spec, pmu, terms, 0);
+}
+
+static int resolve_cache(struct perf_event_spec *spec, const char *name){
+    for (int c = 0; c < PERF_COUNT_HW_CACHE_MAX; c++) {
+        size_t len = strlen(cache_names[c]);
+        if (strncmp(name, cache_names[c], len) || name[len] != '-')
+            continue;
+
+        const char *rest = name + len + 1;
+        size_t rest_len = strlen(rest);
+        int result = PERF_COUNT_HW_CACHE_RESULT_ACCESS;
+        if (rest_len > 7 && !strcmp(rest + rest_len - 7, "-misses")) {
+            result = PERF_COUNT_HW_CACHE_RESULT_MISS;
+            rest_len -= 7;
+        }
+        for (int op = 0; op < PERF_COUNT_HW_CACHE_OP_MAX; op++) {
+            size_t op_len = strlen(cache_ops[op]);
+            if (rest_len < op_len || strncmp(rest, cache_ops[op], op_len))
+                continue;
+            const char *plural = rest + op_len;
+            size_t plural_len = rest_len - op_len;
+            if (plural_len == 0 || (plural_len == 1 && *plural == 's') ||
+                (plural_len == 2 && !strncmp(plural, "es", 2))) {
+                spec->type = PERF_TYPE_HW_CACHE;
+                spec->config = config_cache_id(c, op, result);
+                return 0;
+            }
+        }
+    }
+    return -ENOENT;
+}
+
+static int resolve_kprobe(struct perf_event_list *list, struct perf_event_spec *spec,
+                          const char *probe, int retprobe){
+    char buf[64];
+    int type = perf_pmu_type("kprobe");
+    if (type < 0)
+        return type;
+    spec->type = type;
+
+    size_t len = strcspn(probe, "+");
+    if (len == 0)
+        return -EINVAL;
+    if (probe[len] == '+') {
+        char *end;
+        spec->config2 = strtoull(probe + len + 1, &end, 0);  // probe_offset
+        if (*end)
+            return -EINVAL;
+    }
+    char *func = list_strdup(list, probe, len);
+    if (!func)
+        return -ENOMEM;
+    spec->config1 = (uint64_t)(uintptr_t)func;  // kprobe_func
+
+    if (retprobe) {
+        if (pmu_file("kprobe", "format", "retprobe", buf, sizeof(buf)))
+            return -EOPNOTSUPP;
+        return apply_format(spec, buf, 1);
+    }
+    return 0;
+}
+
+static int resolve_tracepoint(struct perf_event_spec *spec, const char *sys, size_t sys_len,
+                              const char *event){
+    static const char *const roots[] = { "/sys/kernel/tracing/events",
+                                         "/sys/kernel/debug/tracing/events" };
+    char path[PATH_MAX];
+    char buf[32];
+    int err = -ENOENT;
+
+    for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%.*s/%s/id", roots[i], (int)sys_len, sys, event);
+        err = read_sysfs(path, buf, sizeof(buf));
+        if (!err) {
+            spec->type = PERF_TYPE_TRACEPOINT;
+            spec->config = strtoull(buf, NULL, 10);
+            return 0;
+        }
+    }
+    return err;
+}
+
+/* Look a bare name up as an events/ alias, core PMUs first */
+static int resolve_alias(struct perf_event_list *list, struct perf_event_spec *spec, const char *name){
+    static const char *const core_pmus[] = { "cpu", "cpu_core", "armv8_pmuv3" };
+    char buf[512];
+
+    for (size_t i = 0; i < sizeof(core_pmus) / sizeof(core_pmus[0]); i++) {
+        if (pmu_file(core_pmus[i], "events", name, buf, sizeof(buf)) == 0)
+            return resolve_pmu(list, spec, core_pmus[i], name);
+    }
+
+    DIR *d = opendir(PMU_SYSFS);
+    if (!d)
+        return -ENOENT;
+    int err = -ENOENT;
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        if (de->d_name[0] == '.')
+            continue;
+        if (pmu_file(de->d_name, "events", name, buf, sizeof(buf)) == 0) {
+            err = resolve_pmu(list, spec, de->d_name, name);
+            break;
+        }
+    }
+    closedir(d);
+    return err;
+}
+
+static int is_modifier(const char *s){
+    if (!*s)
+        return 0;
+    for (; *s; s++) {
+        if (*s != 'u' && *s != 'k' && *s != 'h')
+            return 0;
+    }
+    return 1;
+}
+
+static uint32_t modifier_flags(const char *mods){
+    int user = strchr(mods, 'u') != NULL;
+    int kernel = strchr(mods, 'k') != NULL;
+    if (user && !kernel)
+        return PERF_SPEC_EXCLUDE_KERNEL;
+    if (kernel && !user)
+        return PERF_SPEC_EXCLUDE_USER;
+    return 0;
+}
+
+/**
+ * perf_event_resolve - Resolve one event @name and append it to @list.
+ * @flags: PERF_SPEC_* flags to start from, e.g. PERF_SPEC_NEW_GROUP.
+ *
+ * Returns 0, -ENOENT if the event is not known on this host, -EINVAL on a
+ * malformed name or any error from reading sysfs. On failure @name is
+ * copied to list->error.
+ */
+int perf_event_resolve(struct perf_event_list *list, const char *name, uint32_t flags){
+    struct perf_event_spec spec = { .flags = flags };
+    char buf[256];
+    int err;
+
+    snprintf(list->error, sizeof(list->error), "%s", name);
+    if (strlen(name) >= sizeof(buf))
+        return -ENAMETOOLONG;
+    snprintf(buf, sizeof(buf), "%s", name);
+
+    if (!strncmp(buf, "kprobe:", 7) || !strncmp(buf, "kretprobe:", 10)) {
+        int ret = buf[1] == 'r';
+        err = resolve_kprobe(list, &spec, strchr(buf, ':') + 1, ret);
+        goto out;
+    }
+
+    // Strip a trailing ":u"/":k" or "/u" modifier
+    char *slash = strchr(buf, '/');
+    char *last = slash ? strrchr(buf, '/') : NULL;
+    char *colon = strrchr(last ? last : buf, ':');
+    if (colon && is_modifier(colon + 1)) {
+        spec.flags |= modifier_flags(colon + 1);
+        *colon = '\0';
+    } else if (last && last != slash && is_modifier(last + 1)) {
+        spec.flags |= modifier_flags(last + 1);
+        last[1] = '\0';
+    }
+
+    if (slash) {
+        if (!last || last == slash || last[1] != '\0') {
+            err = -EINVAL;
+            goto out;
+        }
+        *slash = '\0';
+        *last = '\0';
+        err = resolve_pmu(list, &spec, buf, slash + 1);
+        goto out;
+    }
+
+    if (buf[0] == 'r' && buf[1] && strspn(buf + 1, "0123456789abcdefABCDEF") == strlen(buf + 1)) {
+        spec.type = PERF_TYPE_RAW;
+        spec.config = strtoull(buf + 1, NULL, 16);
+        err = 0;
+        goto out;
+    }
+
+    for (size_t i = 0; i < sizeof(generic_events) / sizeof(generic_events[0]); i++) {
+        if (!strcmp(buf, generic_events[i].name)) {
+            spec.type = generic_events[i].type;
+            spec.config = generic_events[i].config;
+            err = 0;
+            goto out;
+        }
+    }
+
+    err = resolve_cache(&spec, buf);
+    if (err != -ENOENT)
+        goto out;
+
+    colon = strchr(buf, ':');
+    if (colon) {
+        err = resolve_tracepoint(&spec, buf, colon - buf, colon + 1);
+        goto out;
+    }
+
+    err = resolve_alias(list, &spec, buf);
+
+out:
+    if (err)
+        return err;
+    if (!(spec.name = list_strdup(list, name, strlen(name))))
+        return -ENOMEM;
+    list->error[0] = '\0';
+    return list_push(list, &spec);
+}
+
+/**
+ * perf_event_list_parse - Resolve a comma separated event list into @list.
+ *
+ * Events inside "{...}" are opened as one group; every other event gets a
+ * group of its own so that the kernel can multiplex it independently.
+ * @list must be zeroed before the first call; events are appended.
+ */
+int perf_event_list_parse(struct perf_event_list *list, const char *str){
+    char token[256];
+    int in_group = 0;
+    int group_start = 0;
+    const char *p = str;
+
+    while (*p) {
+        if (*p == '{') {
+            if (in_group) {
+                snprintf(list->error, sizeof(list->error), "nested '{' in %s", str);
+                return -EINVAL;
+            }
+            in_group = group_start = 1;
+            p++;
+            continue;
+        }
+
+        size_t len = 0;
+        int in_terms = 0;
+        while (p[len] && (in_terms || (p[len] != ',' && p[len] != '}'))) {
+            if (p[len] == '/')
+                in_terms = !in_terms;
+            len++;
+        }
+        if (len == 0 || len >= sizeof(token)) {
+            snprintf(list->error, sizeof(list->error), "%.*s", (int)len, p);
+            return -EINVAL;
+        }
+        memcpy(token, p, len);
+        token[len] = '\0';
+        p += len;
+
+        uint32_t flags = (!in_group || group_start) ? PERF_SPEC_NEW_GROUP : 0;
+        group_start = 0;
+        int err = perf_event_resolve(list, token, flags);
+        if (err)
+            return err;
+
+        if (*p == '}') {
+            if (!in_group) {
+                snprintf(list->error, sizeof(list->error), "unmatched '}' in %s", str);
+                return -EINVAL;
+            }
+            in_group = 0;
+            p++;
+        }
+        if (*p == ',')
+            p++;
+    }
+    if (in_group) {
+        snprintf(list->error, sizeof(list->error), "missing '}' in %s", str);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+void perf_event_list_free(struct perf_event_list *list){
+    for (int i = 0; i < list->nr_strings; i++)
+        free(list->strings[i]);
+    free(list->strings);
+    free(list->specs);
+    memset(list, 0, sizeof(*list));
+}
+
+/**
+ * perf_list_events - Print the events perf_event_resolve() accepts on this host.
+ */
+void perf_list_events(FILE *out){
+    fprintf(out, "Generic events:\n");
+    for (size_t i = 0; i < sizeof(generic_events) / sizeof(generic_events[0]); i++)
+        fprintf(out, "  %-40s [%s]\n", generic_events[i].name,
+                generic_events[i].type == PERF_TYPE_HARDWARE ? "Hardware event" : "Software event");
+
+    fprintf(out, "\nCache events:\n");
+    for (int c = 0; c < PERF_COUNT_HW_CACHE_MAX; c++) {
+        for (int op = 0; op < PERF_COUNT_HW_CACHE_OP_MAX; op++) {
+            fprintf(out, "  %s-%s%s\n", cache_names[c], cache_ops[op],
+                    op == PERF_COUNT_HW_CACHE_OP_PREFETCH ? "es" : "s");
+            fprintf(out, "  %s-%s-misses\n", cache_names[c], cache_ops[op]);
+        }
+    }
+
+    fprintf(out, "\nProbes and tracepoints:\n");
+    fprintf(out, "  %-40s [%s]\n", "kprobe:<func>[+<offset>]",
+            perf_pmu_type("kprobe") < 0 ? "not available" : "Kprobe event");
+    fprintf(out, "  %-40s [%s]\n", "kretprobe:<func>",
+            perf_pmu_type("kprobe") < 0 ? "not available" : "Kprobe event");
+    fprintf(out, "  %-40s [%s]\n", "<subsys>:<tracepoint>", "Tracepoint event");
+
+    DIR *d = opendir(PMU_SYSFS);
+    if (!d)
+        return;
+    fprintf(out, "\nPMU events:\n");
+    struct dirent *pmu;
+    while ((pmu = readdir(d))) {
+        char path[PATH_MAX];
+        if (pmu->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), PMU_SYSFS "/%s/events", pmu->d_name);
+        DIR *ev = opendir(path);
+        if (!ev)
+            continue;
+        int uncore = pmu_is_uncore(pmu->d_name);
+        struct dirent *e;
+        while ((e = readdir(ev))) {
+            if (e->d_name[0] == '.' || strchr(e->d_name, '.'))
+                continue;  // skip .scale/.unit/.snapshot companions
+            fprintf(out, "  %s/%s/%*s [%s]\n", pmu->d_name, e->d_name,
+                    (int)(38 - strlen(pmu->d_name) - strlen(e->d_name)) > 0 ?
+                    (int)(38 - strlen(pmu->d_name) - strlen(e->d_name)) : 0, "",
+                    uncore ? "Uncore PMU event" : "Kernel PMU event");
+        }
+        closedir(ev);
+    }
+    closedir(d);
+}
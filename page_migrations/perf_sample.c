@@ -0,0 +1,275 @@
+#include "perf_events.h"
+#include <errno.h>
+#include <sys/mman.h>
+
+#define SAMPLE_BASE (PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_ADDR)
+#define SAMPLE_MEM  (PERF_SAMPLE_WEIGHT | PERF_SAMPLE_DATA_SRC)
+
+static int open_sampler(struct perf_sampler *s, const struct perf_event_spec *spec, uint64_t period,
+                        pid_t pid, int cpu, uint64_t sample_type, int precise_ip){
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.size = sizeof(pe);
+    pe.type = spec->type;
+    pe.config = spec->config;
+    pe.config1 = spec->config1;
+    pe.config2 = spec->config2;
+    pe.sample_period = period;
+    pe.sample_type = sample_type;
+    pe.precise_ip = precise_ip;
+    pe.disabled = 1;
+    pe.exclude_kernel = !!(spec->flags & PERF_SPEC_EXCLUDE_KERNEL);
+    pe.exclude_user = !!(spec->flags & PERF_SPEC_EXCLUDE_USER);
+    pe.exclude_hv = 1;
+
+    int fd = syscall(__NR_perf_event_open, &pe, pid, cpu, -1, 0);
+    if (fd < 0)
+        return -errno;
+    s->fd = fd;
+    s->period = period;
+    s->sample_type = sample_type;
+    s->precise_ip = precise_ip;
+    return 0;
+}
+
+/*
+ * Try the requested event from the most to the least precise configuration.
+ * PHYS_ADDR needs CAP_SYS_ADMIN and is dropped first.
+ */
+static int open_pmu_sampler(struct perf_sampler *s, const struct perf_event_spec *spec, uint64_t period,
+                            pid_t pid, int cpu){
+    int err = -EOPNOTSUPP;
+
+    for (int precise = 3; precise >= 0; precise--) {
+        uint64_t types[] = { SAMPLE_BASE | SAMPLE_MEM | PERF_SAMPLE_PHYS_ADDR,
+                             SAMPLE_BASE | SAMPLE_MEM,
+                             SAMPLE_BASE };
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            err = open_sampler(s, spec, period, pid, cpu, types[i], precise);
+            if (!err) {
+                // precise without data source and weight is only a better IP
+                s->mode = precise && (types[i] & SAMPLE_MEM) == SAMPLE_MEM ?
+                          PERF_SAMPLE_MODE_PRECISE : PERF_SAMPLE_MODE_PMU;
+                return 0;
+            }
+            if (err != -EINVAL && err != -EOPNOTSUPP && err != -EACCES && err != -EPERM)
+                return err;
+        }
+    }
+    return err;
+}
+
+/**
+ * perf_sampler_open - Open a sampling event and map its ring buffer.
+ * @spec: the event to sample, normally a memory-load event such as
+ *        cpu/mem-loads,ldlat=30/; NULL to sample page faults directly
+ * @data_pages: ring buffer size in pages, rounded up to a power of two
+ *
+ * Falls back to sampling the page-faults software event when @spec cannot
+ * be sampled on this PMU. s->mode says which configuration was opened.
+ */
+int perf_sampler_open(struct perf_sampler *s, const struct perf_event_spec *spec, uint64_t period,
+                      pid_t pid, int cpu, unsigned data_pages){
+    static const struct perf_event_spec page_faults = {
+        "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, 0, 0, 0
+    };
+    int err = -EOPNOTSUPP;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+
+    if (spec && spec->type != PERF_TYPE_SOFTWARE)
+        err = open_pmu_sampler(s, spec, period, pid, cpu);
+    if (err) {
+        err = open_sampler(s, spec && spec->type == PERF_TYPE_SOFTWARE ? spec : &page_faults,
+                           spec && spec->type == PERF_TYPE_SOFTWARE ? period : 1,
+                           pid, cpu, SAMPLE_BASE, 0);
+        if (err)
+            return err;
+        s->mode = PERF_SAMPLE_MODE_SOFTWARE;
+    }
+
+    unsigned pages = 1;
+    while (pages < data_pages)
+        pages <<= 1;
+    long page_size = sysconf(_SC_PAGESIZE);
+    s->data_size = (uint64_t)pages * page_size;
+    s->mmap_size = (pages + 1) * page_size;
+    s->base = mmap(NULL, s->mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (s->base == MAP_FAILED) {
+        err = -errno;
+        s->base = NULL;
+        perf_sampler_close(s);
+        return err;
+    }
+    s->meta = s->base;
+    return 0;
+}
+
+void perf_sampler_close(struct perf_sampler *s){
+    if (s->base)
+        munmap(s->base, s->mmap_size);
+    if (s->fd >= 0)
+        close(s->fd);
+    s->base = NULL;
+    s->meta = NULL;
+    s->fd = -1;
+}
+
+int perf_sampler_enable(struct perf_sampler *s){
+    if (ioctl(s->fd, PERF_EVENT_IOC_RESET, 0) < 0 || ioctl(s->fd, PERF_EVENT_IOC_ENABLE, 0) < 0)
+        return -errno;
+    return 0;
+}
+
+int perf_sampler_disable(struct perf_sampler *s){
+    if (ioctl(s->fd, PERF_EVENT_IOC_DISABLE, 0) < 0)
+        return -errno;
+    return 0;
+}
+
+static void decode_sample(const struct perf_sampler *s, const uint64_t *p, struct perf_sample *out){
+    memset(out, 0, sizeof(*out));
+    // Fields appear in the order of the PERF_SAMPLE_* bits
+    if (s->sample_type & PERF_SAMPLE_IP)
+        out->ip = *p++;
+    if (s->sample_type & PERF_SAMPLE_TID) {
+        out->pid = (uint32_t)*p;
+        out->tid = (uint32_t)(*p >> 32);
+        p++;
+    }
+    if (s->sample_type & PERF_SAMPLE_ADDR)
+        out->addr = *p++;
+    if (s->sample_type & PERF_SAMPLE_WEIGHT)
+        out->weight = *p++;
+    if (s->sample_type & PERF_SAMPLE_DATA_SRC)
+        out->data_src = *p++;
+    if (s->sample_type & PERF_SAMPLE_PHYS_ADDR)
+        out->phys_addr = *p++;
+}
+
+/**
+ * perf_sampler_consume - Hand every pending sample to @fn and free its slot.
+ *
+ * Records are decoded in place in the mapped ring; only a record that wraps
+ * around the end of the ring is copied, into s->bounce. Stops early and
+ * returns the value of @fn if it is non-zero, otherwise returns the number
+ * of samples consumed.
+ */
+int perf_sampler_consume(struct perf_sampler *s, perf_sample_fn fn, void *ctx){
+    const unsigned char *data = (const unsigned char *)s->base + s->meta->data_offset;
+    uint64_t size = s->meta->data_size ? s->meta->data_size : s->data_size;
+    uint64_t head = __atomic_load_n(&s->meta->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = s->meta->data_tail;
+    int nr = 0;
+    int ret = 0;
+
+    if (!s->meta->data_offset)
+        data = (const unsigned char *)s->base + sysconf(_SC_PAGESIZE);
+
+    while (tail < head) {
+        uint64_t off = tail & (size - 1);
+        const struct perf_event_header *hdr = (const void *)(data + off);
+        struct perf_event_header wrapped;
+
+        if (off + sizeof(*hdr) > size) {
+            size_t first = size - off;
+            memcpy(&wrapped, data + off, first);
+            memcpy((char *)&wrapped + first, data, sizeof(wrapped) - first);
+            hdr = &wrapped;
+        }
+        if (hdr->size == 0)
+            break;
+
+        const void *rec = data + off;
+        if (off + hdr->size > size) {
+            if (hdr->size > sizeof(s->bounce)) {
+                tail += hdr->size;
+                continue;
+            }
+            size_t first = size - off;
+            memcpy(s->bounce, data + off, first);
+            memcpy((char *)s->bounce + first, data, hdr->size - first);
+            rec = s->bounce;
+        }
+
+        if (hdr->type == PERF_RECORD_SAMPLE) {
+            struct perf_sample sample;
+            decode_sample(s, (const uint64_t *)((const char *)rec + sizeof(*hdr)), &sample);
+            nr++;
+            ret = fn(&sample, ctx);
+        } else if (hdr->type == PERF_RECORD_LOST) {
+            s->lost += ((const uint64_t *)((const char *)rec + sizeof(*hdr)))[1];
+        }
+        tail += hdr->size;
+        if (ret)
+            break;
+    }
+
+    __atomic_store_n(&s->meta->data_tail, tail, __ATOMIC_RELEASE);
+    return ret ? ret : nr;
+}
+
+/**
+ * perf_mem_classify - Reduce a PERF_SAMPLE_DATA_SRC value to where the load
+ * was served from. Uses the mem_lvl_num/mem_remote encoding when the PMU
+ * provides it and the older mem_lvl bitmap otherwise.
+ */
+enum perf_mem_source perf_mem_classify(uint64_t data_src){
+    uint64_t lvl = (data_src >> PERF_MEM_LVL_SHIFT) & 0x3fff;
+    uint64_t lvlnum = (data_src >> PERF_MEM_LVLNUM_SHIFT) & 0xf;
+    int remote = (data_src >> PERF_MEM_REMOTE_SHIFT) & 1;
+
+    if (lvlnum && lvlnum != PERF_MEM_LVLNUM_NA) {
+        switch (lvlnum) {
+        case PERF_MEM_LVLNUM_L1:
+        case PERF_MEM_LVLNUM_L2:
+        case PERF_MEM_LVLNUM_L3:
+        case PERF_MEM_LVLNUM_L4:
+        case PERF_MEM_LVLNUM_LFB:
+        case PERF_MEM_LVLNUM_ANY_CACHE:
+            return remote ? PERF_MEM_SRC_REMOTE_CACHE : PERF_MEM_SRC_CACHE;
+        case PERF_MEM_LVLNUM_RAM:
+            return remote ? PERF_MEM_SRC_REMOTE_RAM : PERF_MEM_SRC_LOCAL_RAM;
+        default:
+            return PERF_MEM_SRC_OTHER;
+        }
+    }
+
+    if (!lvl || (lvl & PERF_MEM_LVL_NA))
+        return PERF_MEM_SRC_NA;
+    if (lvl & (PERF_MEM_LVL_REM_RAM1 | PERF_MEM_LVL_REM_RAM2))
+        return PERF_MEM_SRC_REMOTE_RAM;
+    if (lvl & (PERF_MEM_LVL_REM_CCE1 | PERF_MEM_LVL_REM_CCE2))
+        return PERF_MEM_SRC_REMOTE_CACHE;
+    if (lvl & PERF_MEM_LVL_LOC_RAM)
+        return PERF_MEM_SRC_LOCAL_RAM;
+    if (lvl & (PERF_MEM_LVL_L1 | PERF_MEM_LVL_LFB | PERF_MEM_LVL_L2 | PERF_MEM_LVL_L3))
+        return PERF_MEM_SRC_CACHE;
+    return PERF_MEM_SRC_OTHER;
+}
+
+const char *perf_mem_source_name(enum perf_mem_source src){
+    static const char *const names[PERF_MEM_SRC_MAX] = {
+        [PERF_MEM_SRC_NA]           = "n/a",
+        [PERF_MEM_SRC_CACHE]        = "cache",
+        [PERF_MEM_SRC_LOCAL_RAM]    = "local-dram",
+        [PERF_MEM_SRC_REMOTE_CACHE] = "remote-cache",
+        [PERF_MEM_SRC_REMOTE_RAM]   = "remote-dram",
+        [PERF_MEM_SRC_OTHER]        = "other",
+    };
+    return src < PERF_MEM_SRC_MAX ? names[src] : "?";
+}
+
+const char *perf_sample_mode_name(enum perf_sample_mode mode){
+    switch (mode) {
+    case PERF_SAMPLE_MODE_PRECISE:
+        return "precise";
+    case PERF_SAMPLE_MODE_PMU:
+        return "pmu";
+    case PERF_SAMPLE_MODE_SOFTWARE:
+        return "software";
+    }
+    return "?";
+}
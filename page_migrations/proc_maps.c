@@ -0,0 +1,141 @@
+#include "proc_maps.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct vma_info *find_vma(struct vma_list *list, unsigned long start){
+    int lo = 0, hi = list->nr - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (list->vmas[mid].start == start)
+            return &list->vmas[mid];
+        if (list->vmas[mid].start < start)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
+
+static int read_maps(pid_t pid, struct vma_list *list){
+    char path[64];
+    char line[4096];
+
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -errno;
+
+    while (fgets(line, sizeof(line), f)) {
+        struct vma_info vma;
+        int pos = 0;
+
+        memset(&vma, 0, sizeof(vma));
+        if (sscanf(line, "%lx-%lx %4s %*x %*s %*u %n", &vma.start, &vma.end, vma.perms, &pos) < 3)
+            continue;
+        if (pos) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(vma.path, sizeof(vma.path), "%s", line + pos);
+        }
+        vma.page_size = sysconf(_SC_PAGESIZE);
+
+        if (list->nr == list->cap) {
+            int cap = list->cap ? 2 * list->cap : 64;
+            struct vma_info *vmas = realloc(list->vmas, cap * sizeof(*vmas));
+            if (!vmas) {
+                fclose(f);
+                return -ENOMEM;
+            }
+            list->vmas = vmas;
+            list->cap = cap;
+        }
+        list->vmas[list->nr++] = vma;
+    }
+    fclose(f);
+    return 0;
+}
+
+/*
+ * numa_maps lines look like
+ *   7f2c4a000000 default anon=512 dirty=512 N0=256 N1=256 kernelpagesize_kB=4
+ * and start at the same address as the matching maps entry.
+ */
+static int read_numa_maps(pid_t pid, struct vma_list *list){
+    char path[64];
+    char line[4096];
+
+    snprintf(path, sizeof(path), "/proc/%d/numa_maps", pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -errno;
+
+    while (fgets(line, sizeof(line), f)) {
+        char *save;
+        char *tok = strtok_r(line, " \n", &save);
+        if (!tok)
+            continue;
+        struct vma_info *vma = find_vma(list, strtoul(tok, NULL, 16));
+        if (!vma)
+            continue;
+        if ((tok = strtok_r(NULL, " \n", &save)))
+            snprintf(vma->policy, sizeof(vma->policy), "%s", tok);
+
+        while ((tok = strtok_r(NULL, " \n", &save))) {
+            if (tok[0] == 'N' && tok[1] >= '0' && tok[1] <= '9') {
+                char *eq;
+                long node = strtol(tok + 1, &eq, 10);
+                if (*eq == '=' && node < PROC_MAX_NODES)
+                    vma->node_pages[node] = strtoul(eq + 1, NULL, 10);
+            } else if (!strncmp(tok, "anon=", 5)) {
+                vma->anon = strtoul(tok + 5, NULL, 10);
+            } else if (!strncmp(tok, "kernelpagesize_kB=", 18)) {
+                vma->page_size = strtoul(tok + 18, NULL, 10) * 1024;
+            }
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/**
+ * proc_maps_read - Read the VMAs of @pid, annotated from numa_maps.
+ *
+ * Returns 0 or -errno. A kernel without CONFIG_NUMA has no numa_maps; the
+ * VMAs are still returned, with zero node counts.
+ */
+int proc_maps_read(pid_t pid, struct vma_list *list){
+    memset(list, 0, sizeof(*list));
+    int err = read_maps(pid, list);
+    if (err) {
+        vma_list_free(list);
+        return err;
+    }
+    err = read_numa_maps(pid, list);
+    if (err && err != -ENOENT) {
+        vma_list_free(list);
+        return err;
+    }
+    return 0;
+}
+
+void vma_list_free(struct vma_list *list){
+    free(list->vmas);
+    memset(list, 0, sizeof(*list));
+}
+
+/* Pages of @vma that numa_maps reports on any of @nodes */
+unsigned long vma_pages_on(const struct vma_info *vma, const int *nodes, int nr_nodes){
+    unsigned long pages = 0;
+    for (int i = 0; i < nr_nodes; i++) {
+        if (nodes[i] >= 0 && nodes[i] < PROC_MAX_NODES)
+            pages += vma->node_pages[nodes[i]];
+    }
+    return pages;
+}
+
+/* [vdso], [vvar], [vsyscall] and friends cannot be migrated */
+int vma_is_special(const struct vma_info *vma){
+    return !strncmp(vma->path, "[v", 2);
+}
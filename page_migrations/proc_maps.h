@@ -0,0 +1,37 @@
+#ifndef PROC_MAPS_H
+#define PROC_MAPS_H
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The address space of a process as seen through /proc/<pid>/maps, with the
+ * per-node page counts and page size of each VMA from /proc/<pid>/numa_maps.
+ */
+
+#define PROC_MAX_NODES 64
+
+struct vma_info {
+    unsigned long start;
+    unsigned long end;
+    char perms[5];
+    unsigned long page_size;                    // kernelpagesize_kB, in bytes
+    unsigned long anon;                         // anon= pages
+    unsigned long node_pages[PROC_MAX_NODES];   // N<node>= pages
+    char policy[32];                            // memory policy, e.g. "default", "bind:0"
+    char path[256];                             // backing file or [heap], [stack], ...
+};
+
+struct vma_list {
+    int nr;
+    int cap;
+    struct vma_info *vmas;
+};
+
+int proc_maps_read(pid_t pid, struct vma_list *list);
+void vma_list_free(struct vma_list *list);
+unsigned long vma_pages_on(const struct vma_info *vma, const int *nodes, int nr_nodes);
+int vma_is_special(const struct vma_info *vma);
+#endif
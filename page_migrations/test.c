@@ -8,35 +8,32 @@
 #define NUM_EVENTS 4
 
 int main(void) {
-    char* names[NUM_EVENTS] = {
-        "CPU Cycles",
-        "Instructions",
-        "L1D Cache Loads",
-        "L1D Cache Load Misses"
-    };
-    uint64_t types[NUM_EVENTS] = {
-        PERF_TYPE_HARDWARE,
-        PERF_TYPE_HARDWARE,
-        PERF_TYPE_HW_CACHE,
-        PERF_TYPE_HW_CACHE
-    };
-    uint64_t configs[NUM_EVENTS] = {
-        PERF_COUNT_HW_CPU_CYCLES,
-        PERF_COUNT_HW_INSTRUCTIONS,
-        config_cache_id(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS),
-        config_cache_id(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)
+    struct perf_event_spec specs[NUM_EVENTS] = {
+        { "CPU Cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0, 0, 0 },
+        { "Instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0, 0, 0 },
+        { "L1D Cache Loads", PERF_TYPE_HW_CACHE,
+          config_cache_id(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_ACCESS), 0, 0, 0 },
+        { "L1D Cache Load Misses", PERF_TYPE_HW_CACHE,
+          config_cache_id(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), 0, 0, 0 }
     };
 
-    struct perf_event_attr pe;
-    int fds[NUM_EVENTS];
-    uint64_t ids[NUM_EVENTS];
-    int group_fd;
+    struct perf_set perf;
+    struct perf_count start[NUM_EVENTS], end[NUM_EVENTS], delta[NUM_EVENTS];
 
     printf("Configuring %d perf events...\n", NUM_EVENTS);
-    group_fd = config_perf_multi(&pe, fds, ids, types, configs, NUM_EVENTS);
+    int err = perf_set_open(&perf, specs, NUM_EVENTS, PERF_SCOPE_THREAD, 0, -1);
+    if (err) {
+        fprintf(stderr, "Error opening event #%d: %s\n", perf.failed_idx, strerror(-err));
+        return 1;
+    }
 
     printf("Starting workload...\n");
-    reset_and_enable_ioctl(group_fd);
+    if ((err = perf_set_reset(&perf)) || (err = perf_set_enable(&perf)) ||
+        (err = perf_set_read(&perf, start))) {
+        fprintf(stderr, "perf: %s\n", strerror(-err));
+        perf_set_close(&perf);
+        return 1;
+    }
 
     // --- YOUR WORKLOAD GOES HERE ---
     volatile int total = 0;
@@ -45,12 +42,18 @@ int main(void) {
     }
     // -------------------------------
 
-    get_perf(names, ids, NUM_EVENTS, group_fd);
+    err = perf_set_read(&perf, end);
+    perf_set_disable(&perf);
+    if (err) {
+        fprintf(stderr, "perf_set_read: %s\n", strerror(-err));
+        perf_set_close(&perf);
+        return 1;
+    }
+    perf_count_delta(end, start, delta, NUM_EVENTS);
+    perf_print_counts(stdout, perf.names, delta, NUM_EVENTS);
     printf("Workload finished.\n");
 
-    for (int i = 0; i < NUM_EVENTS; i++) {
-        close(fds[i]);
-    }
+    perf_set_close(&perf);
 
     return 0;
-}
\ No newline at end of file
+}
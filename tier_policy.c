@@ -0,0 +1,245 @@
+// Tiering policy: which pages to move each epoch, and how fast.
+//
+// Migration cost is modelled as fixed + page * pages per move_pages call,
+// fitted online from what the calls actually cost.  The model turns the
+// CPU budget into a page rate; the bandwidth budget caps it further.  The
+// batch size follows AIMD: it grows while calls cost what the model
+// predicts, and halves when a call is much slower (contention) or when
+// many pages fail to move.
+#include <stdlib.h>
+#include "tier_policy.h"
+
+#define COST_DECAY              0.9
+#define COST_PRIOR_FIXED_NS     10000.0
+#define COST_PRIOR_PAGE_NS      2000.0
+#define SLOW_CALL               2.0     /* observed / predicted that counts as contention */
+#define FAIL_BACKOFF            0.25    /* failed share of a batch that halves it */
+
+/* ------------- Cost model ------------- */
+void tier_cost_init(struct tier_cost *c)
+{
+        *c = (struct tier_cost){
+                .fixed_ns = COST_PRIOR_FIXED_NS,
+                .page_ns  = COST_PRIOR_PAGE_NS,
+        };
+}
+
+/**
+ * tier_cost_observe - Fold one move_pages call of @pages pages, @failed of
+ * which did not move, that cost @ns into the model.
+ *
+ * The fit is a least-squares line over exponentially decayed sums.  Until
+ * batch sizes vary enough to separate the two terms, the fixed cost keeps
+ * its prior and the rest is charged per page.
+ */
+void tier_cost_observe(struct tier_cost *c, unsigned long pages, unsigned long failed, double ns)
+{
+        double x = pages, mx, my, var;
+
+        if (!pages)
+                return;
+        c->sw  = COST_DECAY * c->sw  + 1;
+        c->sx  = COST_DECAY * c->sx  + x;
+        c->sy  = COST_DECAY * c->sy  + ns;
+        c->sxx = COST_DECAY * c->sxx + x * x;
+        c->sxy = COST_DECAY * c->sxy + x * ns;
+        c->samples++;
+        c->fail_rate = c->samples == 1 ? (double)failed / pages
+                                       : 0.8 * c->fail_rate + 0.2 * failed / pages;
+
+        mx  = c->sx / c->sw;
+        my  = c->sy / c->sw;
+        var = c->sxx / c->sw - mx * mx;
+        if (c->samples >= 3 && var > 0.01 * mx * mx) {
+                double slope = (c->sxy / c->sw - mx * my) / var;
+                if (slope > 0) {
+                        c->page_ns  = slope;
+                        c->fixed_ns = my - slope * mx > 0 ? my - slope * mx : 0;
+                        return;
+                }
+        }
+        double page = (ns - c->fixed_ns) / x;
+        if (page > 0)
+                c->page_ns = c->samples == 1 ? page : 0.7 * c->page_ns + 0.3 * page;
+}
+
+double tier_cost_predict(const struct tier_cost *c, unsigned long pages)
+{
+        return pages ? c->fixed_ns + c->page_ns * pages : 0;
+}
+
+/* ------------- Controller ------------- */
+void tier_ctl_init(struct tier_ctl *t, const struct tier_budget *b, unsigned int hot_min)
+{
+        t->budget  = *b;
+        t->hot_min = hot_min ? hot_min : 1;
+        t->batch   = b->min_batch;
+        t->rate    = 0;
+        t->cpu_ns  = 0;
+        tier_cost_init(&t->cost);
+}
+
+/**
+ * tier_ctl_plan - Set the page rate and move_pages time for an epoch of
+ * @epoch_ns, from the budget and the current cost model.
+ */
+void tier_ctl_plan(struct tier_ctl *t, double epoch_ns)
+{
+        double per_page = t->cost.fixed_ns / t->batch + t->cost.page_ns;
+        double rate;
+
+        t->cpu_ns = t->budget.cpu_frac * epoch_ns;
+        rate = t->cpu_ns / per_page;
+        if (t->budget.mb_per_s > 0) {
+                double bw = t->budget.mb_per_s * (1 << 20) / 4096 * epoch_ns / 1e9;
+                if (bw < rate)
+                        rate = bw;
+        }
+        /* Failed pages cost as much as moved ones and buy nothing */
+        rate *= 1 - t->cost.fail_rate;
+        t->rate = rate > 0 ? (unsigned long)rate : 0;
+}
+
+static void ctl_feedback(struct tier_ctl *t, unsigned long pages, unsigned long failed,
+                         double ns, double predicted)
+{
+        tier_cost_observe(&t->cost, pages, failed, ns);
+        if (ns > SLOW_CALL * predicted || failed > FAIL_BACKOFF * pages) {
+                t->batch /= 2;
+                if (t->batch < t->budget.min_batch)
+                        t->batch = t->budget.min_batch;
+        } else {
+                t->batch += t->budget.min_batch;
+                if (t->batch > t->budget.max_batch)
+                        t->batch = t->budget.max_batch;
+        }
+}
+
+/* ------------- Selection ------------- */
+static int by_count_desc(const void *a, const void *b)
+{
+        const struct tier_page *x = a, *y = b;
+        return (y->count > x->count) - (y->count < x->count);
+}
+
+/**
+ * tier_select - Choose this epoch's migrations.
+ *
+ * Hot pages (at least hot_min accesses) that are not on @fast are promoted,
+ * hottest first.  When @fast has room for fewer than that (@fast_free
+ * pages), cold pages on @fast are demoted to make room.  Promotions and
+ * demotions together stay within the epoch's rate.  @hot and @cold are
+ * reordered in place; the plan points into them.
+ */
+void tier_select(const struct tier_ctl *t, struct tier_page *hot, unsigned long nr_hot,
+                 struct tier_page *cold, unsigned long nr_cold, int fast, long fast_free,
+                 struct tier_plan *plan)
+{
+        unsigned long nh = 0, nc = 0, p, d = 0;
+        unsigned long room = fast_free > 0 ? fast_free : 0;
+
+        for (unsigned long i = 0; i < nr_hot; i++) {
+                if (hot[i].count >= t->hot_min && hot[i].node >= 0 && hot[i].node != fast)
+                        hot[nh++] = hot[i];
+        }
+        qsort(hot, nh, sizeof(*hot), by_count_desc);
+        for (unsigned long i = 0; i < nr_cold; i++) {
+                if (cold[i].node == fast)
+                        cold[nc++] = cold[i];
+        }
+
+        p = nh < t->rate ? nh : t->rate;
+        if (p > room) {
+                /* every promotion past the free room costs a demotion */
+                unsigned long half = (t->rate + room) / 2;
+                if (p > half)
+                        p = half;
+                d = p > room ? p - room : 0;
+                if (d > nc)
+                        d = nc;
+                if (p > room + d)
+                        p = room + d;
+        }
+
+        plan->promote    = hot;
+        plan->nr_promote = p;
+        plan->demote     = cold;
+        plan->nr_demote  = d;
+}
+
+/* ------------- Execution ------------- */
+static int move_batches(struct tier_ctl *t, struct tier_page *pages, unsigned long n,
+                        int node, int promote, tier_move_fn move, void *ctx,
+                        struct tier_epoch *ep)
+{
+        for (unsigned long done = 0; done < n; ) {
+                unsigned long nr = n - done < t->batch ? n - done : t->batch;
+                double predicted = tier_cost_predict(&t->cost, nr);
+                unsigned long moved = 0;
+                double ns = 0;
+                int err;
+
+                if (ep->cost_ns + predicted > t->cpu_ns)
+                        break;                  /* CPU budget spent */
+                err = move(ctx, pages + done, nr, node, &ns);
+                if (err)
+                        return err;
+
+                for (unsigned long i = done; i < done + nr; i++) {
+                        if (pages[i].node != node)
+                                continue;
+                        moved++;
+                        /* assume the next epoch looks like this one */
+                        if (promote)
+                                ep->remote_delta -= pages[i].count;
+                        else
+                                ep->remote_delta += pages[i].count;
+                }
+                if (promote)
+                        ep->promoted += moved;
+                else
+                        ep->demoted += moved;
+                ep->failed  += nr - moved;
+                ep->cost_ns += ns;
+                ep->calls++;
+                ctl_feedback(t, nr, nr - moved, ns, predicted);
+                done += nr;
+        }
+        return 0;
+}
+
+/**
+ * tier_execute - Carry out @plan: demote to @slow first so promotions to
+ * @fast find room, then promote.  Stops early once the epoch's move_pages
+ * time is spent.  Fills the counters of @ep; ep->remote is left to the
+ * caller.
+ */
+int tier_execute(struct tier_ctl *t, struct tier_plan *plan, int fast, int slow,
+                 tier_move_fn move, void *ctx, struct tier_epoch *ep)
+{
+        int err = 0;
+
+        if (plan->nr_demote && slow >= 0)
+                err = move_batches(t, plan->demote, plan->nr_demote, slow, 0, move, ctx, ep);
+        if (!err && plan->nr_promote)
+                err = move_batches(t, plan->promote, plan->nr_promote, fast, 1, move, ctx, ep);
+        ep->batch = t->batch;
+        ep->rate  = t->rate;
+        return err;
+}
+
+void tier_epoch_print(FILE *out, const struct tier_epoch *ep, int header)
+{
+        if (header)
+                fprintf(out, "%6s %9s %8s %7s %6s %9s %8s %9s %10s %6s %8s %9s %9s\n",
+                        "EPOCH", "PROMOTED", "DEMOTED", "FAILED", "CALLS", "COST(ms)",
+                        "MB", "REMOTE", "dREMOTE", "dREM%", "BATCH", "RATE", "us/PAGE");
+
+        unsigned long pages = ep->promoted + ep->demoted + ep->failed;
+        fprintf(out, "%6lu %9lu %8lu %7lu %6lu %9.3f %8.2f %9lu %+10ld %5.1f%% %8lu %9lu %9.2f\n",
+                ep->epoch, ep->promoted, ep->demoted, ep->failed, ep->calls,
+                ep->cost_ns / 1e6, (ep->promoted + ep->demoted) * 4096.0 / (1 << 20),
+                ep->remote, ep->remote_delta,
+                ep->remote ? 100.0 * ep->remote_delta / ep->remote : 0.0,
+                ep->batch, ep->rate, pages ? ep->cost_ns / 1e3 / pages : 0.0);
+}
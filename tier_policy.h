@@ -0,0 +1,92 @@
+#ifndef __TIER_POLICY_H
+#define __TIER_POLICY_H
+
+#include <stdio.h>
+
+/*
+ * Policy core of the tiering daemon, shared by tierd (live, BPF) and
+ * tier_sim (trace replay on a virtual topology).  It knows nothing about
+ * how accesses are sampled or how pages are moved: callers hand it the
+ * pages seen this epoch and a move function.
+ */
+
+struct tier_page {
+        unsigned long addr;
+        unsigned int count;     /* accesses sampled this epoch */
+        int node;               /* current node, or -errno */
+};
+
+/* ------------- Budget ------------- */
+struct tier_budget {
+        double cpu_frac;                /* share of one CPU spent migrating */
+        double mb_per_s;                /* migration bandwidth cap, 0 = none */
+        unsigned long min_batch;        /* pages per move_pages call */
+        unsigned long max_batch;
+};
+
+#define TIER_BUDGET_DEFAULT { 0.05, 256, 64, 4096 }
+
+/* ------------- Online cost model: ns = fixed + page * pages ------------- */
+struct tier_cost {
+        double fixed_ns;
+        double page_ns;
+        double fail_rate;               /* EWMA of failed / attempted pages */
+        unsigned long samples;
+        double sw, sx, sy, sxx, sxy;    /* decayed sums for the least-squares fit */
+};
+
+void tier_cost_init(struct tier_cost *c);
+void tier_cost_observe(struct tier_cost *c, unsigned long pages, unsigned long failed, double ns);
+double tier_cost_predict(const struct tier_cost *c, unsigned long pages);
+
+/* ------------- Controller ------------- */
+struct tier_ctl {
+        struct tier_budget budget;
+        struct tier_cost cost;
+        unsigned int hot_min;           /* accesses per epoch to count as hot */
+        unsigned long batch;            /* current pages per call (AIMD) */
+        unsigned long rate;             /* pages allowed this epoch */
+        double cpu_ns;                  /* move_pages time allowed this epoch */
+};
+
+void tier_ctl_init(struct tier_ctl *t, const struct tier_budget *b, unsigned int hot_min);
+void tier_ctl_plan(struct tier_ctl *t, double epoch_ns);
+
+/* ------------- Selection ------------- */
+struct tier_plan {
+        struct tier_page *promote;      /* hot pages off @fast, hottest first */
+        unsigned long nr_promote;
+        struct tier_page *demote;       /* cold pages on @fast */
+        unsigned long nr_demote;
+};
+
+void tier_select(const struct tier_ctl *t, struct tier_page *hot, unsigned long nr_hot,
+                 struct tier_page *cold, unsigned long nr_cold, int fast, long fast_free,
+                 struct tier_plan *plan);
+
+/* ------------- Execution and report ------------- */
+struct tier_epoch {
+        unsigned long epoch;
+        unsigned long promoted;
+        unsigned long demoted;
+        unsigned long failed;
+        unsigned long calls;
+        double cost_ns;                 /* time spent in the move function */
+        unsigned long remote;           /* remote accesses sampled this epoch */
+        long remote_delta;              /* estimated change for the next epoch */
+        unsigned long batch;            /* controller state at the end */
+        unsigned long rate;
+};
+
+/*
+ * Move @n pages to @node.  On return pages[i].node holds the node of each
+ * page or -errno, and *ns the cost of the call.  Returns 0 or -errno.
+ */
+typedef int (*tier_move_fn)(void *ctx, struct tier_page *pages, unsigned long n,
+                            int node, double *ns);
+
+int tier_execute(struct tier_ctl *t, struct tier_plan *plan, int fast, int slow,
+                 tier_move_fn move, void *ctx, struct tier_epoch *ep);
+void tier_epoch_print(FILE *out, const struct tier_epoch *ep, int header);
+
+#endif /* __TIER_POLICY_H */
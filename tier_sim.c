@@ -0,0 +1,381 @@
+// Replay a recorded access trace against a virtual NUMA topology and run
+// the tiering policy on it, so policies can be compared on any machine.
+//
+// The trace is the one tierd -o writes: one "<epoch> <addr> <count>" line
+// per page and epoch, in epoch order, '#' starts a comment.  Pages are
+// placed on first touch, filling the nodes in the order of -t.  Moves are
+// charged with a synthetic cost model and fail at random or when the
+// target node is full.
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <string.h>
+#include "tier_policy.h"
+
+#define SIM_MAX_NODES   16
+
+struct sim_node {
+        int id;
+        unsigned long capacity;         /* pages */
+        unsigned long used;
+        double lat_ns;                  /* access latency from the workload's CPUs */
+};
+
+struct sim_page {
+        unsigned long addr;             /* 0: empty slot */
+        unsigned long last_epoch;       /* last epoch with a sampled access */
+        int node;                       /* index into sim.nodes */
+};
+
+struct sim {
+        struct sim_node nodes[SIM_MAX_NODES];
+        int nr_nodes;
+        struct sim_page *table;         /* open addressing on addr */
+        unsigned long size, nr;
+        double fixed_ns, page_ns;       /* synthetic move_pages cost */
+        double fail;                    /* probability a page fails to move */
+        double jitter;                  /* +- share of noise on each call */
+        unsigned long long rng;
+};
+
+static int node_index(const struct sim *s, int id)
+{
+        for (int i = 0; i < s->nr_nodes; i++) {
+                if (s->nodes[i].id == id)
+                        return i;
+        }
+        return -1;
+}
+
+static double sim_random(struct sim *s)
+{
+        s->rng ^= s->rng << 13;
+        s->rng ^= s->rng >> 7;
+        s->rng ^= s->rng << 17;
+        return (s->rng >> 11) * (1.0 / (1ULL << 53));
+}
+
+/* ------------- Page table ------------- */
+static unsigned long hash_addr(unsigned long addr, unsigned long size)
+{
+        return ((addr >> 12) * 0x9e3779b97f4a7c15ULL) & (size - 1);
+}
+
+static int table_grow(struct sim *s)
+{
+        unsigned long size = s->size ? 2 * s->size : 1 << 16;
+        struct sim_page *table = calloc(size, sizeof(*table));
+
+        if (!table)
+                return -ENOMEM;
+        for (unsigned long i = 0; i < s->size; i++) {
+                unsigned long h;
+                if (!s->table[i].addr)
+                        continue;
+                for (h = hash_addr(s->table[i].addr, size); table[h].addr; h = (h + 1) & (size - 1))
+                        ;
+                table[h] = s->table[i];
+        }
+        free(s->table);
+        s->table = table;
+        s->size = size;
+        return 0;
+}
+
+/* Find @addr, placing it on first touch */
+static struct sim_page *sim_lookup(struct sim *s, unsigned long addr)
+{
+        unsigned long h;
+
+        if (4 * (s->nr + 1) > 3 * s->size && table_grow(s))
+                return NULL;
+        for (h = hash_addr(addr, s->size); s->table[h].addr; h = (h + 1) & (s->size - 1)) {
+                if (s->table[h].addr == addr)
+                        return &s->table[h];
+        }
+
+        int n = s->nr_nodes - 1;        /* everything full: overcommit the last node */
+        for (int i = 0; i < s->nr_nodes; i++) {
+                if (s->nodes[i].used < s->nodes[i].capacity) {
+                        n = i;
+                        break;
+                }
+        }
+        s->nodes[n].used++;
+        s->table[h] = (struct sim_page){ .addr = addr, .node = n };
+        s->nr++;
+        return &s->table[h];
+}
+
+/* ------------- Virtual move_pages ------------- */
+static int sim_move(void *ctx, struct tier_page *pages, unsigned long n, int node, double *ns)
+{
+        struct sim *s = ctx;
+        int to = node_index(s, node);
+
+        if (to < 0)
+                return -EINVAL;
+        for (unsigned long i = 0; i < n; i++) {
+                struct sim_page *p = sim_lookup(s, pages[i].addr);
+                if (!p)
+                        return -ENOMEM;
+                if (p->node == to) {
+                        pages[i].node = node;
+                } else if (s->nodes[to].used >= s->nodes[to].capacity) {
+                        pages[i].node = -ENOMEM;
+                } else if (sim_random(s) < s->fail) {
+                        pages[i].node = -EBUSY;
+                } else {
+                        s->nodes[p->node].used--;
+                        s->nodes[to].used++;
+                        p->node = to;
+                        pages[i].node = node;
+                }
+        }
+        *ns = (s->fixed_ns + s->page_ns * n) * (1 + s->jitter * (2 * sim_random(s) - 1));
+        return 0;
+}
+
+/* ------------- Trace ------------- */
+struct trace {
+        FILE *f;
+        unsigned long epoch, addr;      /* lookahead record */
+        unsigned int count;
+        int have;
+};
+
+static int trace_next(struct trace *t)
+{
+        char line[256];
+
+        t->have = 0;
+        while (fgets(line, sizeof(line), t->f)) {
+                if (line[0] == '#' || line[0] == '\n')
+                        continue;
+                if (sscanf(line, "%lu %lx %u", &t->epoch, &t->addr, &t->count) == 3) {
+                        t->have = 1;
+                        break;
+                }
+        }
+        return t->have;
+}
+
+static int parse_topology(struct sim *s, char *spec)
+{
+        char *save, *tok;
+
+        for (tok = strtok_r(spec, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+                struct sim_node *n = &s->nodes[s->nr_nodes];
+                if (s->nr_nodes == SIM_MAX_NODES)
+                        return -E2BIG;
+                if (sscanf(tok, "%d=%lu@%lf", &n->id, &n->capacity, &n->lat_ns) != 3 || n->id < 0)
+                        return -EINVAL;
+                if (node_index(s, n->id) >= 0)
+                        return -EEXIST;
+                s->nr_nodes++;
+        }
+        return s->nr_nodes ? 0 : -EINVAL;
+}
+
+static int push_page(struct tier_page **v, unsigned long *nr, unsigned long *cap,
+                     const struct tier_page *p)
+{
+        if (*nr == *cap) {
+                unsigned long c = *cap ? 2 * *cap : 1024;
+                struct tier_page *nv = realloc(*v, c * sizeof(**v));
+                if (!nv)
+                        return -ENOMEM;
+                *v = nv;
+                *cap = c;
+        }
+        (*v)[(*nr)++] = *p;
+        return 0;
+}
+
+static void usage(const char *prog)
+{
+        fprintf(stderr,
+                "Usage: %s -t <topology> -T <trace> [-L fast-node] [-R slow-node]\n"
+                "          [-e epoch-ms] [-C cpu%%] [-b MB/s] [-B max-batch] [-H hot-min]\n"
+                "          [-k cold-epochs] [-m fixed-us,page-us,fail[,jitter]] [-s seed]\n"
+                "  -t  nodes as id=capacity-pages@access-ns, e.g. 0=4096@80,1=1048576@140;\n"
+                "      first touch fills them in this order\n"
+                "  -T  access trace from tierd -o, '-' for stdin\n"
+                "  -L  node to promote to (default: first of -t)\n"
+                "  -R  node to demote to (default: first other node of -t)\n"
+                "  -e  virtual epoch length (default 1000)\n"
+                "  -C  CPU budget in %% of one CPU (default 5)\n"
+                "  -b  bandwidth budget in MB/s, 0 for none (default 256)\n"
+                "  -B  largest move_pages batch (default 4096)\n"
+                "  -H  accesses per epoch that make a page hot (default 2)\n"
+                "  -k  epochs without access that make a page cold (default 2)\n"
+                "  -m  synthetic move cost (default 15,2.5,0.01,0.2)\n",
+                prog);
+}
+
+int main(int argc, char **argv)
+{
+        struct sim s = { .fixed_ns = 15000, .page_ns = 2500, .fail = 0.01, .jitter = 0.2, .rng = 88172645463325252ULL };
+        struct tier_budget budget = TIER_BUDGET_DEFAULT;
+        struct trace tr = { 0 };
+        struct tier_ctl ctl;
+        char *topology = NULL, *trace = NULL;
+        int fast = -1, slow = -1, opt, err = 0;
+        unsigned int hot_min = 2;
+        unsigned long cold_epochs = 2;
+        double epoch_ms = 1000, fixed_us, page_us;
+        unsigned long long seed = 0;
+        struct tier_page *hot = NULL, *cold = NULL;
+        unsigned long nr_hot, cap_hot = 0, nr_cold, cap_cold = 0;
+        unsigned long total_moved = 0, total_failed = 0;
+        double total_ns = 0;
+        struct placement { unsigned long epoch, accesses, remote; double lat; } *truth = NULL;
+        unsigned long nr_truth = 0;
+
+        while ((opt = getopt(argc, argv, "t:T:L:R:e:C:b:B:H:k:m:s:h")) != -1) {
+                switch (opt) {
+                case 't': topology = optarg; break;
+                case 'T': trace = optarg; break;
+                case 'L': fast = atoi(optarg); break;
+                case 'R': slow = atoi(optarg); break;
+                case 'e': epoch_ms = strtod(optarg, NULL); break;
+                case 'C': budget.cpu_frac = strtod(optarg, NULL) / 100; break;
+                case 'b': budget.mb_per_s = strtod(optarg, NULL); break;
+                case 'B': budget.max_batch = strtoul(optarg, NULL, 0); break;
+                case 'H': hot_min = strtoul(optarg, NULL, 0); break;
+                case 'k': cold_epochs = strtoul(optarg, NULL, 0); break;
+                case 'm':
+                        fixed_us = s.fixed_ns / 1e3;
+                        page_us = s.page_ns / 1e3;
+                        if (sscanf(optarg, "%lf,%lf,%lf,%lf", &fixed_us, &page_us, &s.fail, &s.jitter) < 2) {
+                                usage(argv[0]);
+                                return 1;
+                        }
+                        s.fixed_ns = fixed_us * 1e3;
+                        s.page_ns = page_us * 1e3;
+                        break;
+                case 's': seed = strtoull(optarg, NULL, 0); break;
+                default:
+                        usage(argv[0]);
+                        return opt == 'h' ? 0 : 1;
+                }
+        }
+        if (!topology || !trace || epoch_ms <= 0 || !budget.max_batch) {
+                usage(argv[0]);
+                return 1;
+        }
+        if ((err = parse_topology(&s, topology))) {
+                fprintf(stderr, "bad topology '%s': %s\n", topology, strerror(-err));
+                return 1;
+        }
+        if (fast < 0)
+                fast = s.nodes[0].id;
+        for (int i = 0; slow < 0 && i < s.nr_nodes; i++) {
+                if (s.nodes[i].id != fast)
+                        slow = s.nodes[i].id;
+        }
+        if (node_index(&s, fast) < 0 || (slow >= 0 && node_index(&s, slow) < 0)) {
+                fprintf(stderr, "-L/-R must name nodes of the topology\n");
+                return 1;
+        }
+        if (budget.min_batch > budget.max_batch)
+                budget.min_batch = budget.max_batch;
+        s.rng ^= seed * 0x9e3779b97f4a7c15ULL;
+        if (table_grow(&s))
+                return 1;
+
+        tr.f = strcmp(trace, "-") ? fopen(trace, "r") : stdin;
+        if (!tr.f) {
+                perror(trace);
+                return 1;
+        }
+
+        tier_ctl_init(&ctl, &budget, hot_min);
+        trace_next(&tr);
+        for (int header = 1; tr.have; header = 0) {
+                unsigned long epoch = tr.epoch, accesses = 0, remote = 0;
+                struct tier_epoch ep = { .epoch = epoch };
+                struct tier_plan plan;
+                int fi = node_index(&s, fast);
+                double lat = 0;
+
+                /* This epoch's accesses, under the placement it started with */
+                nr_hot = 0;
+                for (; tr.have && tr.epoch == epoch; trace_next(&tr)) {
+                        struct sim_page *p = sim_lookup(&s, tr.addr & ~4095UL);
+                        struct tier_page tp;
+                        if (!p) {
+                                err = -ENOMEM;
+                                break;
+                        }
+                        p->last_epoch = epoch;
+                        accesses += tr.count;
+                        lat += (double)tr.count * s.nodes[p->node].lat_ns;
+                        if (p->node != fi)
+                                remote += tr.count;
+                        tp = (struct tier_page){ p->addr, tr.count, s.nodes[p->node].id };
+                        if ((err = push_page(&hot, &nr_hot, &cap_hot, &tp)))
+                                break;
+                }
+
+                /* Local pages idle for cold_epochs */
+                nr_cold = 0;
+                for (unsigned long i = 0; !err && i < s.size; i++) {
+                        struct sim_page *p = &s.table[i];
+                        if (p->addr && p->node == fi && p->last_epoch + cold_epochs <= epoch) {
+                                struct tier_page tp = { p->addr, 0, fast };
+                                err = push_page(&cold, &nr_cold, &cap_cold, &tp);
+                        }
+                }
+                if (err)
+                        break;
+
+                tier_ctl_plan(&ctl, epoch_ms * 1e6);
+                tier_select(&ctl, hot, nr_hot, cold, nr_cold, fast,
+                            (long)s.nodes[fi].capacity - (long)s.nodes[fi].used, &plan);
+                ep.remote = remote;
+                if ((err = tier_execute(&ctl, &plan, fast, slow, sim_move, &s, &ep)))
+                        break;
+
+                tier_epoch_print(stdout, &ep, header);
+                struct placement *t = realloc(truth, (nr_truth + 1) * sizeof(*truth));
+                if (!t) {
+                        err = -ENOMEM;
+                        break;
+                }
+                truth = t;
+                truth[nr_truth++] = (struct placement){ epoch, accesses, remote, lat };
+                total_moved += ep.promoted + ep.demoted;
+                total_failed += ep.failed;
+                total_ns += ep.cost_ns;
+        }
+        if (err)
+                fprintf(stderr, "simulation failed: %s\n", strerror(-err));
+
+        /* What the accesses of each epoch actually cost under the placement
+         * left by the previous epochs */
+        printf("\n%6s %10s %8s %9s\n", "EPOCH", "ACCESSES", "REMOTE%", "LAT(ns)");
+        for (unsigned long i = 0; i < nr_truth; i++) {
+                const struct placement *t = &truth[i];
+                printf("%6lu %10lu %7.1f%% %9.1f\n", t->epoch, t->accesses,
+                       t->accesses ? 100.0 * t->remote / t->accesses : 0.0,
+                       t->accesses ? t->lat / t->accesses : 0.0);
+        }
+
+        printf("\nmoved %lu pages, %lu failed, %.3f ms in move_pages; model %.1f us + %.2f us/page, %.1f%% failing\n",
+               total_moved, total_failed, total_ns / 1e6, ctl.cost.fixed_ns / 1e3,
+               ctl.cost.page_ns / 1e3, 100 * ctl.cost.fail_rate);
+        printf("final placement:");
+        for (int i = 0; i < s.nr_nodes; i++)
+                printf(" N%d=%lu/%lu", s.nodes[i].id, s.nodes[i].used, s.nodes[i].capacity);
+        printf("\n");
+
+        if (tr.f != stdin)
+                fclose(tr.f);
+        free(truth);
+        free(hot);
+        free(cold);
+        free(s.table);
+        return err ? 1 : 0;
+}
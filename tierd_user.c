@@ -0,0 +1,376 @@
+// Closed-loop tiering for one process: every epoch, promote its hot pages
+// that sit off the fast node and, with -R and -I, demote cold ones to make
+// room, within a CPU and bandwidth budget.
+//
+// Accesses come from the hotpages BPF heat map (faults, NUMA hinting faults
+// and, with -I, the page_idle scan).  What migrations cost comes from the
+// mm_migrate_pages tracepoints of migrate_lat: the kernel time of the
+// daemon's own move_pages calls feeds the cost model of tier_policy.c,
+// which sizes batches and the page rate.  Migrations by anybody else are
+// reported as background.  -o records the sampled accesses for tier_sim.
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <bpf/libbpf.h>
+#include "heatmap.h"
+#include "tier_policy.h"
+#include "migrate_lat.h"
+#include "hotpages.skel.h"
+#include "migrate_lat.skel.h"
+#include "page_migrations/migrate_engine.h"
+
+static volatile bool stop = false;
+static void handle_int(int sig) { stop = true; }
+
+/* Kernel-side migrate_pages() activity seen through the tracepoints */
+struct kernel_cost {
+        __u64 calls;
+        __u64 ns;
+        __u64 pages_ok;
+        __u64 pages_failed;
+};
+
+struct mover {
+        pid_t pid;
+        struct ring_buffer *rb;
+        struct kernel_cost self;        /* caused by our move_pages calls */
+        struct kernel_cost background;  /* everybody else, this epoch */
+        void **addrs;
+        int *nodes;
+        int *status;
+        unsigned long cap;
+};
+
+static int handle_event(void *ctx, void *data, unsigned long size)
+{
+        struct mover *m = ctx;
+        const struct lat_event *e = data;
+        struct kernel_cost *k = e->pid == (__u32)getpid() ? &m->self : &m->background;
+
+        k->calls++;
+        k->ns           += e->delta_ns;
+        k->pages_ok     += e->pages_ok;
+        k->pages_failed += e->pages_failed;
+        return 0;
+}
+
+/*
+ * tier_move_fn for the live target.  The cost handed back to the policy is
+ * the kernel time the tracepoints measured for this call, which excludes
+ * the engine's backoff sleeps; without events it falls back to the time
+ * spent inside move_pages.
+ */
+static int live_move(void *ctx, struct tier_page *pages, unsigned long n, int node, double *ns)
+{
+        struct migrate_policy policy = { 2, 100, 1000, 0, MPOL_MF_MOVE };
+        struct migrate_result res;
+        struct mover *m = ctx;
+        __u64 calls, kns;
+        int err;
+
+        if (n > m->cap) {
+                void **addrs = realloc(m->addrs, n * sizeof(*addrs));
+                int *nodes = addrs ? realloc(m->nodes, n * sizeof(*nodes)) : NULL;
+                int *status = nodes ? realloc(m->status, n * sizeof(*status)) : NULL;
+                if (addrs)
+                        m->addrs = addrs;
+                if (nodes)
+                        m->nodes = nodes;
+                if (!status)
+                        return -ENOMEM;
+                m->status = status;
+                m->cap = n;
+        }
+        for (unsigned long i = 0; i < n; i++) {
+                m->addrs[i] = (void *)pages[i].addr;
+                m->nodes[i] = node;
+        }
+
+        ring_buffer__consume(m->rb);
+        calls = m->self.calls;
+        kns = m->self.ns;
+        err = migrate_pages_retry(m->pid, n, m->addrs, m->nodes, m->status, &policy, &res);
+        if (err)
+                return err;
+        ring_buffer__consume(m->rb);
+
+        for (unsigned long i = 0; i < n; i++)
+                pages[i].node = m->status[i];
+        *ns = m->self.calls > calls ? m->self.ns - kns : res.first_pass_ns + res.retry_ns;
+        return 0;
+}
+
+/* Free pages of @node from sysfs, or -errno */
+static long node_free_pages(int node)
+{
+        char path[64], line[256];
+        unsigned long kb;
+        long ret = -ENOENT;
+        FILE *f;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/meminfo", node);
+        f = fopen(path, "r");
+        if (!f)
+                return -errno;
+        while (fgets(line, sizeof(line), f)) {
+                if (sscanf(line, "Node %*d MemFree: %lu kB", &kb) == 1) {
+                        ret = kb / 4;
+                        break;
+                }
+        }
+        fclose(f);
+        return ret;
+}
+
+static void usage(const char *prog)
+{
+        fprintf(stderr,
+                "Usage: %s -p <pid> [-L fast-node] [-R slow-node] [-i secs] [-n epochs]\n"
+                "          [-C cpu%%] [-b MB/s] [-B max-batch] [-H hot-min] [-W MB]\n"
+                "          [-c candidates] [-w sketch-bits] [-r max-regions] [-I] [-S scan-pages]\n"
+                "          [-o trace]\n"
+                "  -L  node to promote hot pages to (default 0)\n"
+                "  -R  node to demote cold pages to; needs -I (default: no demotion)\n"
+                "  -i  epoch length in seconds (default 1)\n"
+                "  -n  number of epochs, 0 runs until ^C (default 0)\n"
+                "  -C  CPU budget in %% of one CPU (default 5)\n"
+                "  -b  bandwidth budget in MB/s, 0 for none (default 256)\n"
+                "  -B  largest move_pages batch (default 4096)\n"
+                "  -H  sampled accesses per epoch that make a page hot (default 2)\n"
+                "  -W  free memory to leave on the fast node (default 256)\n"
+                "  -c  hot candidates kept per epoch (default 16384)\n"
+                "  -w, -r, -I, -S  as for hotpages_user\n"
+                "  -o  append the sampled accesses to a trace for tier_sim\n",
+                prog);
+}
+
+int main(int argc, char **argv)
+{
+        int pid = -1, fast = 0, slow = -1, idle = 0, cand = 16384;
+        unsigned int interval = 1, epochs = 0, hot_min = 2;
+        __u32 bits = 16, max_regions = 65536;
+        unsigned long scan_pages = 262144, watermark_mb = 256;
+        struct tier_budget budget = TIER_BUDGET_DEFAULT;
+        struct mover m = { 0 };
+        struct tier_ctl ctl;
+        struct tier_page *hot = NULL, *cold = NULL;
+        struct idle_scan sc;
+        struct sketch s;
+        struct hot_heap heap;
+        FILE *trace = NULL;
+        int opt, err, ret = 1;
+
+        while ((opt = getopt(argc, argv, "p:L:R:i:n:C:b:B:H:W:c:w:r:IS:o:h")) != -1) {
+                switch (opt) {
+                case 'p': pid = atoi(optarg); break;
+                case 'L': fast = atoi(optarg); break;
+                case 'R': slow = atoi(optarg); break;
+                case 'i': interval = strtoul(optarg, NULL, 0); break;
+                case 'n': epochs = strtoul(optarg, NULL, 0); break;
+                case 'C': budget.cpu_frac = strtod(optarg, NULL) / 100; break;
+                case 'b': budget.mb_per_s = strtod(optarg, NULL); break;
+                case 'B': budget.max_batch = strtoul(optarg, NULL, 0); break;
+                case 'H': hot_min = strtoul(optarg, NULL, 0); break;
+                case 'W': watermark_mb = strtoul(optarg, NULL, 0); break;
+                case 'c': cand = atoi(optarg); break;
+                case 'w': bits = strtoul(optarg, NULL, 0); break;
+                case 'r': max_regions = strtoul(optarg, NULL, 0); break;
+                case 'I': idle = 1; break;
+                case 'S': scan_pages = strtoul(optarg, NULL, 0); break;
+                case 'o':
+                        trace = fopen(optarg, "a");
+                        if (!trace) {
+                                perror(optarg);
+                                return 1;
+                        }
+                        break;
+                default:
+                        usage(argv[0]);
+                        return opt == 'h' ? 0 : 1;
+                }
+        }
+        if (pid <= 0 || cand <= 0 || !interval || bits < 8 || bits > 24 || !max_regions ||
+            !budget.max_batch || fast < 0 || slow == fast) {
+                usage(argv[0]);
+                return 1;
+        }
+        if (budget.min_batch > budget.max_batch)
+                budget.min_batch = budget.max_batch;
+        if (slow >= 0 && !idle)
+                fprintf(stderr, "warning: -R without -I finds no cold pages, nothing will be demoted\n");
+
+        /* ------------- Access sampling ------------- */
+        struct hotpages_bpf *skel = hotpages_bpf__open();
+        if (!skel) { perror("open"); return 1; }
+
+        skel->rodata->target_tgid = pid;
+        skel->rodata->cms_bits = bits;
+        bpf_map__set_max_entries(skel->maps.regions, max_regions);
+        bpf_map__set_max_entries(skel->maps.cms, HOT_CMS_DEPTH << bits);
+        if (hotpages_bpf__load(skel)) {
+                fprintf(stderr, "load hotpages failed\n");
+                hotpages_bpf__destroy(skel);
+                return 1;
+        }
+        skel->links.handle_fault = bpf_program__attach(skel->progs.handle_fault);
+        if (!skel->links.handle_fault) {
+                fprintf(stderr, "attach handle_mm_fault failed\n");
+                hotpages_bpf__destroy(skel);
+                return 1;
+        }
+        skel->links.handle_numa_page = bpf_program__attach(skel->progs.handle_numa_page);
+        skel->links.handle_huge_pmd_numa_page = bpf_program__attach(skel->progs.handle_huge_pmd_numa_page);
+
+        /* ------------- Migration cost ------------- */
+        /* Only the latency tracepoints; the NUMA balancing programs stay unloaded */
+        struct migrate_lat_bpf *lat = migrate_lat_bpf__open();
+        if (lat) {
+                bpf_map__set_max_entries(lat->maps.numa_tasks, 1);
+                bpf_map__set_max_entries(lat->maps.events, 1 << 20);
+        }
+        if (!lat || migrate_lat_bpf__load(lat) || migrate_lat_bpf__attach(lat)) {
+                fprintf(stderr, "load/attach migrate_lat failed\n");
+                goto out_lat;
+        }
+        m.pid = pid;
+        m.rb = ring_buffer__new(bpf_map__fd(lat->maps.events), handle_event, &m, NULL);
+        if (!m.rb) {
+                fprintf(stderr, "Failed to create ring buffer\n");
+                goto out_lat;
+        }
+
+        s.bits = bits;
+        s.len = (size_t)HOT_CMS_DEPTH << bits;
+        s.c = mmap(NULL, s.len * sizeof(__u32), PROT_READ | PROT_WRITE, MAP_SHARED,
+                   bpf_map__fd(skel->maps.cms), 0);
+        if (s.c == MAP_FAILED) {
+                perror("mmap sketch");
+                goto out_rb;
+        }
+
+        heap.cap = cand;
+        heap.v = calloc(cand, sizeof(*heap.v));
+        hot = calloc(cand, sizeof(*hot));
+        cold = calloc(cand, sizeof(*cold));
+        if (!heap.v || !hot || !cold) {
+                perror("calloc");
+                goto out_mem;
+        }
+        if (idle && (err = idle_scan_open(&sc, pid, cand))) {
+                fprintf(stderr, "page_idle scan disabled: %s\n", strerror(-err));
+                idle = 0;
+        }
+
+        signal(SIGINT, handle_int);
+        signal(SIGTERM, handle_int);
+
+        tier_ctl_init(&ctl, &budget, hot_min);
+        printf("pid %d: promote to node %d", pid, fast);
+        if (slow >= 0)
+                printf(", demote to node %d", slow);
+        printf(", budget %.1f%% CPU, %.0f MB/s, epoch %us\n",
+               100 * budget.cpu_frac, budget.mb_per_s, interval);
+
+        ret = 0;
+        for (unsigned int epoch = 1; !stop && (!epochs || epoch <= epochs); epoch++) {
+                struct tier_epoch ep = { .epoch = epoch };
+                unsigned long nr_hot = 0, nr_cold = 0;
+                struct epoch_stats st;
+                struct tier_plan plan;
+                long fast_free;
+
+                sleep(interval);
+                ring_buffer__consume(m.rb);
+
+                heap.nr = 0;
+                if (idle && (err = idle_scan_step(&sc, pid, &s, &heap, scan_pages, fast))) {
+                        fprintf(stderr, "page_idle scan: %s\n", strerror(-err));
+                        ret = 1;
+                        break;
+                }
+                err = drain_regions(bpf_map__fd(skel->maps.regions), &s, &heap, &st, max_regions);
+                if (!err) {
+                        /* one candidate per page, or it is promoted and counted twice */
+                        heap_dedup(&heap);
+                        if (heap.nr)
+                                err = query_nodes(pid, heap.v, heap.nr);
+                }
+                if (err) {
+                        fprintf(stderr, "sampling: %s\n", strerror(-err));
+                        ret = 1;
+                        break;
+                }
+
+                for (int i = 0; i < heap.nr; i++) {
+                        const struct hot_page *p = &heap.v[i];
+                        if (trace)
+                                fprintf(trace, "%u %llx %u\n", epoch, p->addr, p->count);
+                        if (p->node >= 0 && p->node != fast)
+                                ep.remote += p->count;
+                        hot[nr_hot++] = (struct tier_page){ p->addr, p->count, p->node };
+                }
+                if (idle && slow >= 0) {
+                        idle_scan_prune(&sc, &s);
+                        for (int i = 0; i < sc.nr_cold; i++)
+                                cold[nr_cold++] = (struct tier_page){ sc.cold[i].addr, 0, fast };
+                }
+
+                fast_free = node_free_pages(fast);
+                if (fast_free < 0) {
+                        fprintf(stderr, "node %d: %s\n", fast, strerror(-fast_free));
+                        ret = 1;
+                        break;
+                }
+                fast_free -= watermark_mb * 256;
+
+                tier_ctl_plan(&ctl, interval * 1e9);
+                tier_select(&ctl, hot, nr_hot, cold, nr_cold, fast, fast_free, &plan);
+                if ((err = tier_execute(&ctl, &plan, fast, slow, live_move, &m, &ep))) {
+                        fprintf(stderr, "move_pages: %s\n", strerror(-err));
+                        ret = 1;
+                        break;
+                }
+                /* Demoted pages leave the cold ring; the rest is found again */
+                if (idle && ep.demoted)
+                        sc.nr_cold = sc.next_cold = 0;
+
+                tier_epoch_print(stdout, &ep, epoch == 1);
+                printf("       kernel %.3f ms in %llu migrate_pages calls; background %llu calls, "
+                       "%llu pages moved, %llu failed\n",
+                       m.self.ns / 1e6, m.self.calls, m.background.calls,
+                       m.background.pages_ok, m.background.pages_failed);
+                memset(&m.self, 0, sizeof(m.self));
+                memset(&m.background, 0, sizeof(m.background));
+                if (trace)
+                        fflush(trace);
+                fflush(stdout);
+                sketch_decay(&s);
+        }
+
+        printf("\nmodel %.1f us + %.2f us/page, %.1f%% failing, batch %lu\n",
+               ctl.cost.fixed_ns / 1e3, ctl.cost.page_ns / 1e3,
+               100 * ctl.cost.fail_rate, ctl.batch);
+        if (idle)
+                idle_scan_close(&sc);
+out_mem:
+        free(heap.v);
+        free(hot);
+        free(cold);
+        munmap((void *)s.c, s.len * sizeof(__u32));
+out_rb:
+        ring_buffer__free(m.rb);
+out_lat:
+        migrate_lat_bpf__destroy(lat);
+        hotpages_bpf__destroy(skel);
+        free(m.addrs);
+        free(m.nodes);
+        free(m.status);
+        if (trace)
+                fclose(trace);
+        return ret;
+}